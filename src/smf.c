@@ -47,6 +47,8 @@
 #include "smf.h"
 #include "smf_private.h"
 
+static void length_heap_remove(smf_t *smf, smf_track_t *track);
+
 /**
  * Allocates new smf_t structure.
  * \return pointer to smf_t or NULL.
@@ -70,6 +72,13 @@ smf_new(void)
 	smf->tempo_array = g_ptr_array_new();
 	assert(smf->tempo_array);
 
+	smf->next_event_heap = g_ptr_array_new();
+	assert(smf->next_event_heap);
+
+	/* Heap of tracks by length gets built when it's needed first; see smf_get_length_pulses(). */
+	smf->length_heap = g_ptr_array_new();
+	assert(smf->length_heap);
+
 	cantfail = smf_set_ppqn(smf, 120);
 	assert(!cantfail);
 
@@ -87,21 +96,386 @@ smf_new(void)
 void
 smf_delete(smf_t *smf)
 {
+	/* Frozen smf is shared; see smf_freeze(). */
+	if (smf->frozen) {
+		smf_frozen_unref(smf);
+		return;
+	}
+
+	/* No point in keeping the heap of tracks by length up to date. */
+	smf->length_heap_is_valid = 0;
+
 	/* Remove all the tracks, from last to first. */
 	while (smf->tracks_array->len > 0)
 		smf_track_delete(g_ptr_array_index(smf->tracks_array, smf->tracks_array->len - 1));
 
 	smf_fini_tempo(smf);
+	smf_release_lazy_buffer(smf);
 
 	assert(smf->tracks_array->len == 0);
 	assert(smf->number_of_tracks == 0);
 	g_ptr_array_free(smf->tracks_array, TRUE);
 	g_ptr_array_free(smf->tempo_array, TRUE);
+	g_ptr_array_free(smf->next_event_heap, TRUE);
+	g_ptr_array_free(smf->length_heap, TRUE);
 
 	memset(smf, 0, sizeof(smf_t));
 	free(smf);
 }
 
+/**
+ * Copies events of "source" to "track", which has to be empty and attached to an smf.  Events are allocated
+ * in bulk, from the arena, and keep their times; nothing gets sorted or recomputed.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+static int
+clone_track_events(smf_track_t *track, const smf_track_t *source)
+{
+	int i;
+	smf_event_t *event, *source_event;
+
+	assert(track->number_of_events == 0);
+	assert(source->first_removed == -1);
+
+	track->arena = smf_arena_new();
+
+	g_ptr_array_free(track->events_array, TRUE);
+	track->events_array = g_ptr_array_sized_new(source->events_array->len);
+
+	for (i = 0; i < source->events_array->len; i++) {
+		source_event = g_ptr_array_index(source->events_array, i);
+
+		if (track->arena != NULL) {
+			event = smf_event_new_from_arena(track->arena, source_event->midi_buffer_length);
+			if (event == NULL)
+				return (-1);
+		} else {
+			event = smf_event_new();
+			if (event == NULL)
+				return (-2);
+
+			if (smf_event_allocate_midi_buffer(event, source_event->midi_buffer_length)) {
+				smf_event_delete(event);
+				return (-3);
+			}
+		}
+
+		memcpy(event->midi_buffer, source_event->midi_buffer, source_event->midi_buffer_length);
+
+		event->track = track;
+		event->event_number = i + 1;
+		event->track_number = track->track_number;
+		event->delta_time_pulses = source_event->delta_time_pulses;
+		event->time_pulses = source_event->time_pulses;
+		event->time_seconds = source_event->time_seconds;
+		event->user_pointer = source_event->user_pointer;
+
+		g_ptr_array_add(track->events_array, event);
+		track->number_of_events++;
+	}
+
+	if (track->number_of_events > 0)
+		track->next_event_number = 1;
+
+	return (0);
+}
+
+/**
+ * Makes "track", which has to be empty, use events of "source", a track of a frozen smf,
+ * instead of having its own.  The frozen smf is kept alive until the track stops sharing them.
+ */
+static void
+share_track_events(smf_track_t *track, smf_track_t *source)
+{
+	assert(track->number_of_events == 0);
+	assert(source->smf->frozen);
+
+	g_ptr_array_free(track->events_array, TRUE);
+	track->events_array = source->events_array;
+	track->number_of_events = source->number_of_events;
+	track->shared_track = source;
+	smf_ref(source->smf);
+
+	if (track->number_of_events > 0)
+		track->next_event_number = 1;
+}
+
+/**
+ * Makes the track stop using events of the frozen smf, leaving it empty.
+ */
+static void
+drop_shared_events(smf_track_t *track)
+{
+	smf_t *frozen = track->shared_track->smf;
+
+	track->events_array = g_ptr_array_new();
+	track->number_of_events = 0;
+	track->next_event_number = -1;
+	track->shared_track = NULL;
+
+	smf_delete(frozen);
+}
+
+/**
+ * Does the work for smf_clone() and, if "share" is nonzero, smf_clone_shared().
+ */
+static smf_t *
+copy_smf(smf_t *smf, int share)
+{
+	int i;
+	smf_t *clone;
+	smf_track_t *track, *source_track;
+
+	clone = smf_new();
+	if (clone == NULL)
+		return (NULL);
+
+	clone->format = smf->format;
+	clone->ppqn = smf->ppqn;
+	clone->frames_per_second = smf->frames_per_second;
+	clone->resolution = smf->resolution;
+
+	if (smf_copy_tempo_map(clone, smf))
+		goto error;
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		/* This also parses the track, if it was loaded lazily. */
+		source_track = smf_get_track_by_number(smf, i);
+
+		track = smf_track_new();
+		if (track == NULL)
+			goto error;
+
+		track->user_pointer = source_track->user_pointer;
+		smf_add_track(clone, track);
+
+		if (share && smf->frozen) {
+			share_track_events(track, source_track);
+		} else if (share && source_track->shared_track != NULL) {
+			share_track_events(track, source_track->shared_track);
+		} else if (clone_track_events(track, source_track)) {
+			g_critical("Cannot allocate events for the copy.");
+			goto error;
+		}
+	}
+
+	/* Tracks were added without changing format, which smf_add_track() might have done. */
+	clone->format = smf->format;
+
+	smf_build_length_heap(clone);
+	smf_rewind(clone);
+
+	return (clone);
+
+error:
+	smf_delete(clone);
+
+	return (NULL);
+}
+
+/**
+ * Makes a copy of the smf: tracks, events, their MIDI data and the tempo map.  Copying is done
+ * in one pass over the events, without recomputing their times or re-sorting anything, so it's
+ * much faster than saving and loading the smf, or adding the events one by one; it's meant to be
+ * cheap enough to take a backup before every destructive edit.  Events of every track are stored
+ * next to each other, just like after smf_load().  Frozen smf (see smf_freeze()) can be cloned too;
+ * the copy is not frozen.  The copy is rewound, and event->user_pointer and track->user_pointer
+ * are copied as they are.
+ *
+ * \return Copy of "smf", or NULL, if something went wrong.
+ */
+smf_t *
+smf_clone(smf_t *smf)
+{
+	return (copy_smf(smf, 0));
+}
+
+/**
+ * Makes a copy-on-write copy of the smf.  Like smf_clone(), except that instead of copying events,
+ * tracks of the copy use events of the frozen smf they came from (see smf_freeze()) for as long
+ * as they stay unmodified.  The first change to the track - adding or removing events, or
+ * a tempo change that moves them in time - gives it a copy of its own, so memory use grows with
+ * the tracks that were edited, not with the size of the song.  To make variants of the song,
+ * freeze it once and clone the frozen smf; cloning then takes time proportional to the number
+ * of tracks.  When cloning smf that is not frozen, only the tracks that are still shared
+ * are shared by the copy; the rest is copied as in smf_clone().
+ *
+ * Events of a shared track belong to the frozen smf: event->track points to the frozen track,
+ * and event->track_number is the number of the track in the frozen smf.  They can be read,
+ * iterated over, used with seek functions and saved, but not modified; smf_event_remove_from_track()
+ * and smf_event_delete() refuse to work on them.  To edit such events, call smf_track_unshare()
+ * on the track first and get the events from the track again.
+ *
+ * \return Copy of "smf", or NULL, if something went wrong.
+ */
+smf_t *
+smf_clone_shared(smf_t *smf)
+{
+	return (copy_smf(smf, 1));
+}
+
+/**
+ * Replaces events of "track" with copies of the events of "source", which may be the same track,
+ * stored next to each other, in order.  Old events_array and arena are left to the caller.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+static int
+copy_events_contiguously(smf_track_t *track, const smf_track_t *source)
+{
+	smf_track_t *copy;
+	smf_event_t *event;
+	int i;
+
+	copy = smf_track_new();
+	if (copy == NULL)
+		return (-1);
+
+	copy->track_number = track->track_number;
+
+	if (clone_track_events(copy, source)) {
+		g_critical("Cannot allocate events for the copy of the track.");
+		smf_track_delete(copy);
+		return (-2);
+	}
+
+	for (i = 0; i < copy->events_array->len; i++) {
+		event = g_ptr_array_index(copy->events_array, i);
+		event->track = track;
+	}
+
+	/* Position in the track stays the same; events are where they were. */
+	track->events_array = copy->events_array;
+	track->arena = copy->arena;
+	track->first_removed = -1;
+
+	memset(copy, 0, sizeof(smf_track_t));
+	free(copy);
+
+	return (0);
+}
+
+/**
+ * Gives the track its own copy of the events it shares with a frozen smf (see smf_clone_shared());
+ * does nothing if the track does not share them.  Routines that modify the track do this
+ * automatically.  Events previously obtained from the track belong to the frozen smf and
+ * should not be used to modify the track afterwards.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_track_unshare(smf_track_t *track)
+{
+	smf_t *frozen;
+
+	if (track->shared_track == NULL)
+		return (0);
+
+	frozen = track->shared_track->smf;
+
+	if (copy_events_contiguously(track, track->shared_track))
+		return (-1);
+
+	track->shared_track = NULL;
+	smf_delete(frozen);
+
+	return (0);
+}
+
+/**
+ * Moves events of the track next to each other in memory, in the order they are played.  After many
+ * edits, events end up scattered over the memory - some in the blocks they were loaded into, with
+ * holes left by the removed ones, and others allocated one by one - and going through them takes
+ * a cache miss for almost every event.  This copies them into a single block, like smf_load() does.
+ * It takes time proportional to the number of events in the track; nothing gets re-sorted or recomputed.
+ *
+ * Pointers to events of the track become invalid; get the events from the track again.
+ * event->user_pointer is kept, and so is the position of the track in the song.  Tracks that were
+ * not parsed yet (see smf_load_lazy()) and tracks shared with a frozen smf (see smf_clone_shared())
+ * are already compact and are left alone.
+ *
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_track_compact(smf_track_t *track)
+{
+	int i;
+	GPtrArray *old_events_array;
+	smf_arena_t *old_arena;
+	smf_event_t *event;
+
+	if (smf_refuse_if_frozen(track->smf, "smf_track_compact"))
+		return (-1);
+
+	if (track->shared_track != NULL || track->lazy_mtrk != NULL)
+		return (0);
+
+	smf_track_renumber_events(track);
+
+	old_events_array = track->events_array;
+	old_arena = track->arena;
+
+	if (copy_events_contiguously(track, track))
+		return (-2);
+
+	/* The copies took over already; free old events without touching the track. */
+	for (i = 0; i < old_events_array->len; i++) {
+		event = g_ptr_array_index(old_events_array, i);
+		event->track = NULL;
+		smf_event_delete(event);
+	}
+
+	g_ptr_array_free(old_events_array, TRUE);
+
+	if (old_arena != NULL)
+		smf_arena_unref(old_arena);
+
+	return (0);
+}
+
+/**
+ * Compacts every track of the smf; see smf_track_compact().
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_compact(smf_t *smf)
+{
+	int i;
+
+	if (smf_refuse_if_frozen(smf, "smf_compact"))
+		return (-1);
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		if (smf_track_compact(g_ptr_array_index(smf->tracks_array, i)))
+			return (-2);
+	}
+
+	return (0);
+}
+
+/**
+ * \internal
+ *
+ * \return Track of "smf" that contains the event, or NULL if there is none.  Usually it's
+ * event->track, but events of tracks shared with a frozen smf belong to the frozen one.
+ */
+smf_track_t *
+smf_track_of_event(const smf_t *smf, const smf_event_t *event)
+{
+	int i;
+	smf_track_t *track;
+
+	if (event->track == NULL || event->track->smf == smf)
+		return (event->track);
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+
+		if (track->shared_track == event->track)
+			return (track);
+	}
+
+	return (NULL);
+}
+
 /**
  * Allocates new smf_track_t structure.
  * \return pointer to smf_track_t or NULL.
@@ -117,6 +491,8 @@ smf_track_new(void)
 
 	memset(track, 0, sizeof(smf_track_t));
 	track->next_event_number = -1;
+	track->first_removed = -1;
+	track->length_heap_index = -1;
 
 	track->events_array = g_ptr_array_new();
 	assert(track->events_array);
@@ -130,13 +506,46 @@ smf_track_new(void)
 void
 smf_track_delete(smf_track_t *track)
 {
+	int i, tempo_changed;
+	smf_t *smf;
+
 	assert(track);
 	assert(track->events_array);
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_delete"))
+		return;
+
+	/* Shared events are not ours to delete.  Stop using them, updating the tempo map like deleting them would. */
+	if (track->shared_track != NULL) {
+		smf = track->smf;
+		tempo_changed = 0;
+
+		for (i = 0; smf != NULL && i < track->events_array->len; i++) {
+			if (smf_event_is_tempo_change_or_time_signature(g_ptr_array_index(track->events_array, i)))
+				tempo_changed = 1;
+		}
+
+		if (smf != NULL)
+			smf_track_remove_from_smf(track);
+
+		drop_shared_events(track);
+
+		if (tempo_changed)
+			smf_create_tempo_map_and_compute_seconds(smf);
+	}
+
 	/* Remove all the events, from last to first. */
 	while (track->events_array->len > 0)
 		smf_event_delete(g_ptr_array_index(track->events_array, track->events_array->len - 1));
 
+	/* No point in parsing the track just to throw it away. */
+	if (track->lazy_mtrk != NULL) {
+		assert(track->smf);
+		track->lazy_mtrk = NULL;
+		track->lazy_mtrk_length = 0;
+		track->smf->number_of_lazy_tracks--;
+	}
+
 	if (track->smf)
 		smf_track_remove_from_smf(track);
 
@@ -144,11 +553,28 @@ smf_track_delete(smf_track_t *track)
 	assert(track->number_of_events == 0);
 	g_ptr_array_free(track->events_array, TRUE);
 
+	/* Events allocated from the arena and detached from the track keep it alive. */
+	if (track->arena != NULL)
+		smf_arena_unref(track->arena);
+
 	memset(track, 0, sizeof(smf_track_t));
 	free(track);
 }
 
 
+/**
+ * Makes smf_find_track_with_next_event() rebuild the heap of tracks.  Needs to be called
+ * whenever tracks are added, removed or renumbered, or their next event changes other than
+ * by smf_get_next_event().  Does not write to the smf if the heap is already invalid, so it's
+ * safe to call from the loader threads.
+ */
+static void
+invalidate_next_event_heap(smf_t *smf)
+{
+	if (smf->next_event_heap_is_valid)
+		smf->next_event_heap_is_valid = 0;
+}
+
 /**
  * Appends smf_track_t to smf.
  */
@@ -159,11 +585,18 @@ smf_add_track(smf_t *smf, smf_track_t *track)
 
 	assert(track->smf == NULL);
 
+	if (smf_refuse_if_frozen(smf, "smf_add_track"))
+		return;
+
 	track->smf = smf;
 	g_ptr_array_add(smf->tracks_array, track);
 
 	smf->number_of_tracks++;
 	track->track_number = smf->number_of_tracks;
+	invalidate_next_event_heap(smf);
+
+	assert(track->length_heap_index == -1);
+	smf_track_update_length(track);
 
 	if (smf->number_of_tracks > 1) {
 		cantfail = smf_set_format(smf, 1);
@@ -177,36 +610,105 @@ smf_add_track(smf_t *smf, smf_track_t *track)
 void
 smf_track_remove_from_smf(smf_track_t *track)
 {
-	int i, j;
+	int i;
 	smf_track_t *tmp;
-	smf_event_t *ev;
 
 	assert(track->smf != NULL);
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_remove_from_smf"))
+		return;
+
+	/* Detached track cannot refer to the file buffer anymore. */
+	smf_track_parse_lazy(track);
+
+	if (track->length_heap_index != -1 && track->smf->length_heap_is_valid)
+		length_heap_remove(track->smf, track);
+
+	track->length_heap_index = -1;
+
 	track->smf->number_of_tracks--;
 
 	assert(track->smf->tracks_array);
 	g_ptr_array_remove(track->smf->tracks_array, track);
+	invalidate_next_event_heap(track->smf);
 
-	/* Renumber the rest of the tracks, so they are consecutively numbered. */
+	/*
+	 * Renumber the rest of the tracks, so they are consecutively numbered.  Events have track
+	 * numbers too; these are fixed when the events are returned by libsmf, see event->track_number.
+	 */
 	for (i = track->track_number; i <= track->smf->number_of_tracks; i++) {
-		tmp = smf_get_track_by_number(track->smf, i);
+		tmp = g_ptr_array_index(track->smf->tracks_array, i - 1);
 		tmp->track_number = i;
-
-		/*
-		 * Events have track numbers too.  I guess this wasn't a wise
-		 * decision.  ;-/
-		 */
-		for (j = 1; j <= tmp->number_of_events; j++) {
-			ev = smf_track_get_event_by_number(tmp, j);
-			ev->track_number = i;
-		}
 	}
 
 	track->track_number = -1;
 	track->smf = NULL;
 }
 
+/**
+ * Moves the track to the position "track_number" in its smf, renumbering the tracks in between.
+ * Takes time proportional to the number of tracks, not events, unless the track contains Tempo Change
+ * or Time Signature events; as the order of tracks decides which of the simultaneous ones takes effect,
+ * the tempo map is rebuilt then.
+ *
+ * \param track Track attached to an smf.
+ * \param track_number New number of the track, from 1 to smf->number_of_tracks.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_track_move(smf_track_t *track, int track_number)
+{
+	int i, first, last;
+	smf_t *smf = track->smf;
+
+	assert(smf != NULL);
+
+	if (smf_refuse_if_frozen(smf, "smf_track_move"))
+		return (-1);
+
+	if (track_number < 1 || track_number > smf->number_of_tracks) {
+		g_critical("smf_track_move: invalid track number %d; valid choices are 1 - %d.",
+			track_number, smf->number_of_tracks);
+		return (-1);
+	}
+
+	if (track_number == track->track_number)
+		return (0);
+
+	if (track_number < track->track_number) {
+		first = track_number;
+		last = track->track_number;
+		memmove(&(smf->tracks_array->pdata[first]), &(smf->tracks_array->pdata[first - 1]),
+			(last - first) * sizeof(gpointer));
+	} else {
+		first = track->track_number;
+		last = track_number;
+		memmove(&(smf->tracks_array->pdata[first - 1]), &(smf->tracks_array->pdata[first]),
+			(last - first) * sizeof(gpointer));
+	}
+
+	smf->tracks_array->pdata[track_number - 1] = track;
+
+	for (i = first; i <= last; i++)
+		((smf_track_t *)g_ptr_array_index(smf->tracks_array, i - 1))->track_number = i;
+
+	/* Track numbers break ties between events happening at the same time. */
+	invalidate_next_event_heap(smf);
+
+	/* Tempo-related events of a lazily loaded track are not known until it's parsed. */
+	smf_track_parse_lazy(track);
+	smf_track_renumber_events(track);
+
+	for (i = 0; i < track->events_array->len; i++) {
+		if (smf_event_is_tempo_change_or_time_signature(g_ptr_array_index(track->events_array, i))) {
+			smf_create_tempo_map_and_compute_seconds(smf);
+			break;
+		}
+	}
+
+	return (0);
+}
+
 /**
  * Allocates new smf_event_t structure.  The caller is responsible for allocating
  * event->midi_buffer, filling it with MIDI data and setting event->midi_buffer_length properly.
@@ -232,6 +734,95 @@ smf_event_new(void)
 	return (event);
 }
 
+/**
+ * \internal
+ *
+ * Allocates smf_event_t structure, together with "midi_buffer_length" bytes for event->midi_buffer,
+ * from the arena.  Event keeps a reference to the arena until it is deleted.
+ * \return pointer to smf_event_t or NULL.
+ */
+smf_event_t *
+smf_event_new_from_arena(smf_arena_t *arena, int midi_buffer_length)
+{
+	smf_event_t *event;
+
+	if (midi_buffer_length <= SMF_INLINE_BUFFER_LENGTH)
+		event = smf_arena_alloc(arena, sizeof(smf_event_t));
+	else
+		event = smf_arena_alloc(arena, sizeof(smf_event_t) + midi_buffer_length);
+
+	if (event == NULL)
+		return (NULL);
+
+	memset(event, 0, sizeof(smf_event_t));
+
+	event->delta_time_pulses = -1;
+	event->time_pulses = -1;
+	event->time_seconds = -1.0;
+	event->track_number = -1;
+
+	/* MIDI data lives inside the event or right after it. */
+	if (midi_buffer_length <= SMF_INLINE_BUFFER_LENGTH)
+		event->midi_buffer = event->inline_buffer;
+	else
+		event->midi_buffer = (unsigned char *)(event + 1);
+
+	event->midi_buffer_length = midi_buffer_length;
+
+	/* No room for a pointer to the arena in smf_event_t; smf_arena_of() finds it from the offset. */
+	event->arena_offset = smf_arena_offset(arena, event);
+	smf_arena_ref(arena);
+
+	return (event);
+}
+
+/**
+ * \internal
+ *
+ * Sets event->midi_buffer to point to storage for "midi_buffer_length" bytes - inside the event,
+ * if the message is short enough, or allocated using malloc(3) otherwise - and sets event->midi_buffer_length.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_event_allocate_midi_buffer(smf_event_t *event, int midi_buffer_length)
+{
+	assert(event->midi_buffer == NULL);
+
+	if (midi_buffer_length <= SMF_INLINE_BUFFER_LENGTH) {
+		event->midi_buffer = event->inline_buffer;
+	} else {
+		event->midi_buffer = malloc(midi_buffer_length);
+		if (event->midi_buffer == NULL) {
+			g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+			return (-1);
+		}
+	}
+
+	event->midi_buffer_length = midi_buffer_length;
+
+	return (0);
+}
+
+/**
+ * \return Nonzero, if event->midi_buffer was allocated using malloc(3) and should be freed
+ * by smf_event_delete().
+ */
+static int
+midi_buffer_is_malloced(const smf_event_t *event)
+{
+	if (event->midi_buffer == NULL)
+		return (0);
+
+	if (event->midi_buffer == event->inline_buffer)
+		return (0);
+
+	/* Allocated from the arena, together with the event? */
+	if (event->arena_offset != 0 && event->midi_buffer == (unsigned char *)(event + 1))
+		return (0);
+
+	return (1);
+}
+
 /**
  * Allocates an smf_event_t structure and fills it with "len" bytes copied
  * from "midi_data".
@@ -248,10 +839,7 @@ smf_event_new_from_pointer(void *midi_data, int len)
 	if (event == NULL)
 		return (NULL);
 
-	event->midi_buffer_length = len;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+	if (smf_event_allocate_midi_buffer(event, len)) {
 		smf_event_delete(event);
 
 		return (NULL); 
@@ -338,10 +926,7 @@ smf_event_new_from_bytes(int first_byte, int second_byte, int third_byte)
 		}
 	}
 
-	event->midi_buffer_length = len;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate MIDI buffer structure: %s", strerror(errno));
+	if (smf_event_allocate_midi_buffer(event, len)) {
 		smf_event_delete(event);
 
 		return (NULL); 
@@ -362,50 +947,56 @@ smf_event_new_from_bytes(int first_byte, int second_byte, int third_byte)
 void
 smf_event_delete(smf_event_t *event)
 {
+	smf_arena_t *arena;
+
+	if (event->track != NULL && smf_refuse_if_frozen(event->track->smf, "smf_event_delete"))
+		return;
+
 	if (event->track != NULL)
 		smf_event_remove_from_track(event);
 
-	if (event->midi_buffer != NULL) {
+	if (event->arena_offset != 0)
+		arena = smf_arena_of(event, event->arena_offset);
+	else
+		arena = NULL;
+
+	if (midi_buffer_is_malloced(event)) {
 		memset(event->midi_buffer, 0, event->midi_buffer_length);
 		free(event->midi_buffer);
 	}
 
 	memset(event, 0, sizeof(smf_event_t));
-	free(event);
+
+	if (arena != NULL)
+		smf_arena_unref(arena);
+	else
+		free(event);
 }
 
 /**
- * Used for sorting track->events_array.
+ * \internal
+ *
+ * Returns index in track->events_array the event happening at "pulses" should be inserted at,
+ * that is, index of the first event that does not happen before it.  New event goes before
+ * the events happening at the same time.
  */
-static gint
-events_array_compare_function(gconstpointer aa, gconstpointer bb)
+int
+smf_track_find_position_pulses(const smf_track_t *track, int pulses)
 {
-	smf_event_t *a, *b;
-	
-	/* "The comparison function for g_ptr_array_sort() doesn't take the pointers
-	    from the array as arguments, it takes pointers to the pointers in the array." */
-	a = (smf_event_t *)*(gpointer *)aa;
-	b = (smf_event_t *)*(gpointer *)bb;
-
-	if (a->time_pulses < b->time_pulses)
-		return (-1);
+	int low = 0, high = track->events_array->len, middle;
+	smf_event_t *event;
 
-	if (a->time_pulses > b->time_pulses)
-		return (1);
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		event = g_ptr_array_index(track->events_array, middle);
 
-	/*
-	 * We need to preserve original order, otherwise things will break
-	 * when there are several events with the same ->time_pulses.
-	 * XXX: This is an ugly hack; we should remove sorting altogether.
-	 */
-
-	if (a->event_number < b->event_number)
-		return (-1);
-
-	if (a->event_number > b->event_number)
-		return (1);
+		if (event->time_pulses < pulses)
+			low = middle + 1;
+		else
+			high = middle;
+	}
 
-	return (0);
+	return (low);
 }
 
 /*
@@ -440,7 +1031,8 @@ remove_eot_if_before_pulses(smf_track_t *track, int pulses)
 void
 smf_track_add_event(smf_track_t *track, smf_event_t *event)
 {
-	int i, last_pulses = 0;
+	int i, position, last_pulses = 0;
+	smf_event_t *next_event;
 
 	assert(track->smf != NULL);
 	assert(event->track == NULL);
@@ -448,6 +1040,14 @@ smf_track_add_event(smf_track_t *track, smf_event_t *event)
 	assert(event->time_pulses >= 0);
 	assert(event->time_seconds >= 0.0);
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_event"))
+		return;
+
+	if (smf_track_unshare(track))
+		return;
+
+	smf_track_renumber_events(track);
+
 	remove_eot_if_before_pulses(track, event->time_pulses);
 
 	event->track = track;
@@ -456,59 +1056,225 @@ smf_track_add_event(smf_track_t *track, smf_event_t *event)
 	if (track->number_of_events == 0) {
 		assert(track->next_event_number == -1);
 		track->next_event_number = 1;
+		invalidate_next_event_heap(track->smf);
 	}
 
 	if (track->number_of_events > 0)
 		last_pulses = smf_track_get_last_event(track)->time_pulses;
 
-	track->number_of_events++;
+	track->number_of_events++;
+
+	/* Are we just appending element at the end of the track? */
+	if (last_pulses <= event->time_pulses) {
+		event->delta_time_pulses = event->time_pulses - last_pulses;
+		assert(event->delta_time_pulses >= 0);
+		g_ptr_array_add(track->events_array, event);
+		event->event_number = track->number_of_events;
+
+	/* We need to insert in the middle of the track. */
+	} else {
+		position = smf_track_find_position_pulses(track, event->time_pulses);
+
+		/* Make room for the event, moving the rest of the track one place forward. */
+		g_ptr_array_add(track->events_array, NULL);
+		memmove(&(track->events_array->pdata[position + 1]), &(track->events_array->pdata[position]),
+			(track->events_array->len - position - 1) * sizeof(gpointer));
+		track->events_array->pdata[position] = event;
+
+		/* Renumber the rest of the events. */
+		for (i = position; i < track->events_array->len; i++)
+			((smf_event_t *)g_ptr_array_index(track->events_array, i))->event_number = i + 1;
+
+		/* Compute ->delta_pulses of the event and fix it for the one following it. */
+		if (position == 0)
+			event->delta_time_pulses = event->time_pulses;
+		else
+			event->delta_time_pulses = event->time_pulses -
+				((smf_event_t *)g_ptr_array_index(track->events_array, position - 1))->time_pulses;
+
+		assert(event->delta_time_pulses >= 0);
+
+		next_event = g_ptr_array_index(track->events_array, position + 1);
+		assert(next_event->time_pulses >= event->time_pulses);
+		next_event->delta_time_pulses = next_event->time_pulses - event->time_pulses;
+	}
+
+	smf_track_update_length(track);
+
+	if (smf_event_is_tempo_change_or_time_signature(event)) {
+		if (smf_event_is_last(event))
+			maybe_add_to_tempo_map(track->smf, event);
+		else
+			smf_create_tempo_map_and_compute_seconds(event->track->smf);
+	}
+}
+
+/**
+ * Used for sorting events passed to smf_track_add_events().
+ */
+static gint
+events_pulses_compare_function(gconstpointer aa, gconstpointer bb)
+{
+	smf_event_t *a, *b;
+
+	a = (smf_event_t *)*(gpointer *)aa;
+	b = (smf_event_t *)*(gpointer *)bb;
+
+	if (a->time_pulses < b->time_pulses)
+		return (-1);
+
+	if (a->time_pulses > b->time_pulses)
+		return (1);
+
+	return (0);
+}
+
+/**
+ * Adds "number_of_events" events to the track at once, at the times "pulses" clocks from the start
+ * of song.  Events don't need to be sorted.  Much faster than adding them one by one: the events
+ * are sorted once and merged into the track in a single pass, and the tempo map is updated once.
+ * Events happening at the same time as the events already in the track are put after them; events
+ * from "events" that happen at the same time stay in the order they were passed.  Just like
+ * smf_track_add_event() does, it removes EOT if any of the events happens after it.
+ *
+ * \param track Track to add the events to.
+ * \param events Events that are not attached to any track.
+ * \param pulses Times of the events, in pulses from the start of song.
+ * \param number_of_events Number of elements in "events" and "pulses".
+ */
+void
+smf_track_add_events(smf_track_t *track, smf_event_t **events, const int *pulses, int number_of_events)
+{
+	int i, old, added, first_changed, last_pulses, tempo_changed = 0;
+	GPtrArray *sorted;
+	smf_event_t *event, *previous_event;
+
+	assert(track->smf != NULL);
+	assert(number_of_events >= 0);
+
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_events"))
+		return;
+
+	if (smf_track_unshare(track))
+		return;
+
+	if (number_of_events == 0)
+		return;
+
+	smf_track_renumber_events(track);
+
+	sorted = g_ptr_array_sized_new(number_of_events);
+
+	for (i = 0; i < number_of_events; i++) {
+		event = events[i];
+
+		assert(event->track == NULL);
+		assert(event->time_pulses == -1);
+		assert(pulses[i] >= 0);
+
+		event->time_pulses = pulses[i];
+		g_ptr_array_add(sorted, event);
+
+		if (smf_event_is_tempo_change_or_time_signature(event))
+			tempo_changed = 1;
+	}
+
+	/* This sort is stable, so events happening at the same time keep their order. */
+	g_ptr_array_sort(sorted, events_pulses_compare_function);
+
+	last_pulses = ((smf_event_t *)g_ptr_array_index(sorted, number_of_events - 1))->time_pulses;
+	remove_eot_if_before_pulses(track, last_pulses);
+
+	if (track->number_of_events == 0) {
+		assert(track->next_event_number == -1);
+		track->next_event_number = 1;
+		invalidate_next_event_heap(track->smf);
+	}
+
+	/* Merge, starting from the end of the track, so it can be done in place. */
+	old = track->events_array->len;
+	added = number_of_events;
+	g_ptr_array_set_size(track->events_array, old + added);
+
+	while (added > 0) {
+		event = g_ptr_array_index(sorted, added - 1);
+		previous_event = old > 0 ? g_ptr_array_index(track->events_array, old - 1) : NULL;
+
+		if (previous_event != NULL && previous_event->time_pulses > event->time_pulses) {
+			track->events_array->pdata[old + added - 1] = previous_event;
+			old--;
+		} else {
+			event->track = track;
+			event->track_number = track->track_number;
+			track->events_array->pdata[old + added - 1] = event;
+			added--;
+		}
+	}
+
+	g_ptr_array_free(sorted, TRUE);
+
+	/* Events before "old" did not move. */
+	first_changed = old;
+	track->number_of_events = track->events_array->len;
+
+	for (i = first_changed; i < track->events_array->len; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+		event->event_number = i + 1;
+
+		if (i == 0)
+			event->delta_time_pulses = event->time_pulses;
+		else
+			event->delta_time_pulses = event->time_pulses -
+				((smf_event_t *)g_ptr_array_index(track->events_array, i - 1))->time_pulses;
+
+		assert(event->delta_time_pulses >= 0);
+	}
+
+	if (tempo_changed)
+		smf_create_tempo_map_and_compute_seconds(track->smf);
+	else
+		smf_track_compute_seconds(track);
+}
+
+/**
+ * \internal
+ *
+ * Appends event at the end of the track and computes ->delta_pulses.  Unlike smf_track_add_event,
+ * it does not check for EOT and does not update the tempo map; it is up to the caller to keep
+ * the tempo map consistent.  Event needs to have ->time_pulses and ->time_seconds already set,
+ * and it must not happen before the last event on the track.  Used by the loader.
+ */
+void
+smf_track_append_event(smf_track_t *track, smf_event_t *event)
+{
+	smf_event_t *last_event;
+
+	assert(track->smf != NULL);
+	assert(event->track == NULL);
+	assert(event->delta_time_pulses == -1);
+	assert(event->time_pulses >= 0);
+	assert(event->time_seconds >= 0.0);
+
+	last_event = smf_track_get_last_event(track);
 
-	/* Are we just appending element at the end of the track? */
-	if (last_pulses <= event->time_pulses) {
-		event->delta_time_pulses = event->time_pulses - last_pulses;
+	if (last_event == NULL) {
+		assert(track->next_event_number == -1);
+		track->next_event_number = 1;
+		invalidate_next_event_heap(track->smf);
+		event->delta_time_pulses = event->time_pulses;
+	} else {
+		event->delta_time_pulses = event->time_pulses - last_event->time_pulses;
 		assert(event->delta_time_pulses >= 0);
-		g_ptr_array_add(track->events_array, event);
-		event->event_number = track->number_of_events;
+	}
 
-	/* We need to insert in the middle of the track.  XXX: This is slow. */
-	} else {
-		/* Append, then sort according to ->time_pulses. */
-		g_ptr_array_add(track->events_array, event);
-		g_ptr_array_sort(track->events_array, events_array_compare_function);
-
-		/* Renumber entries and fix their ->delta_pulses. */
-		for (i = 1; i <= track->number_of_events; i++) {
-			smf_event_t *tmp = smf_track_get_event_by_number(track, i);
-			tmp->event_number = i;
-
-			if (tmp->delta_time_pulses != -1)
-				continue;
-
-			if (i == 1) {
-				tmp->delta_time_pulses = tmp->time_pulses;
-			} else {
-				tmp->delta_time_pulses = tmp->time_pulses -
-					smf_track_get_event_by_number(track, i - 1)->time_pulses;
-				assert(tmp->delta_time_pulses >= 0);
-			}
-		}
+	event->track = track;
+	event->track_number = track->track_number;
 
-		/* Adjust ->delta_time_pulses of the next event. */
-		if (event->event_number < track->number_of_events) {
-			smf_event_t *next_event = smf_track_get_event_by_number(track, event->event_number + 1);
-			assert(next_event);
-			assert(next_event->time_pulses >= event->time_pulses);
-			next_event->delta_time_pulses -= event->delta_time_pulses;
-			assert(next_event->delta_time_pulses >= 0);
-		}
-	}
+	g_ptr_array_add(track->events_array, event);
+	track->number_of_events++;
+	event->event_number = track->number_of_events;
 
-	if (smf_event_is_tempo_change_or_time_signature(event)) {
-		if (smf_event_is_last(event))
-			maybe_add_to_tempo_map(event);
-		else
-			smf_create_tempo_map_and_compute_seconds(event->track->smf);
-	}
+	smf_track_update_length(track);
 }
 
 /**
@@ -525,6 +1291,9 @@ smf_track_add_eot_delta_pulses(smf_track_t *track, int delta)
 {
 	smf_event_t *event;
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_eot_delta_pulses"))
+		return (-4);
+
 	event = smf_event_new_from_bytes(0xFF, 0x2F, 0x00);
 	if (event == NULL)
 		return (-1);
@@ -539,6 +1308,9 @@ smf_track_add_eot_pulses(smf_track_t *track, int pulses)
 {
 	smf_event_t *event, *last_event;
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_eot_pulses"))
+		return (-4);
+
 	last_event = smf_track_get_last_event(track);
 	if (last_event != NULL) {
 		if (last_event->time_pulses > pulses)
@@ -559,6 +1331,9 @@ smf_track_add_eot_seconds(smf_track_t *track, double seconds)
 {
 	smf_event_t *event, *last_event;
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_eot_seconds"))
+		return (-4);
+
 	last_event = smf_track_get_last_event(track);
 	if (last_event != NULL) {
 		if (last_event->time_seconds > seconds)
@@ -575,38 +1350,117 @@ smf_track_add_eot_seconds(smf_track_t *track, double seconds)
 }
 
 /**
- * Detaches event from its track.
+ * \internal
+ *
+ * Squeezes out the slots of events_array left empty by smf_event_remove_from_track(), bringing
+ * ->event_number and ->delta_time_pulses of the events after them up to date.  Takes time
+ * proportional to the number of events after the first removed one, and none if nothing was removed.
+ * Called before anything that looks at events_array by position, e.g. by smf_get_track_by_number()
+ * and smf_track_get_event_by_number().
+ */
+void
+smf_track_renumber_events(smf_track_t *track)
+{
+	int i, kept, previous_pulses;
+	smf_event_t *event;
+
+	if (track->first_removed == -1)
+		return;
+
+	kept = track->first_removed;
+
+	if (kept > 0)
+		previous_pulses = ((smf_event_t *)g_ptr_array_index(track->events_array, kept - 1))->time_pulses;
+	else
+		previous_pulses = 0;
+
+	for (i = track->first_removed; i < track->events_array->len; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+		if (event == NULL)
+			continue;
+
+		event->event_number = kept + 1;
+		event->delta_time_pulses = event->time_pulses - previous_pulses;
+		previous_pulses = event->time_pulses;
+
+		track->events_array->pdata[kept] = event;
+		kept++;
+	}
+
+	g_ptr_array_set_size(track->events_array, kept);
+	track->first_removed = -1;
+
+	assert(track->number_of_events == kept);
+}
+
+/**
+ * \internal
+ *
+ * \return Index of the event in event->track->events_array.  Takes constant time: removing events
+ * leaves their slots empty, so ->event_number of the events after them stays equal to their position
+ * until smf_track_renumber_events() moves and renumbers them both.
+ */
+int
+smf_event_index(const smf_event_t *event)
+{
+	int i = event->event_number - 1;
+
+	assert(i >= 0 && i < event->track->events_array->len);
+	assert(g_ptr_array_index(event->track->events_array, i) == event);
+
+	return (i);
+}
+
+/**
+ * Detaches event from its track.  Takes constant time, unless the event is a Tempo Change or Time
+ * Signature; events after it are not moved or renumbered here, see event->event_number.
  */
 void
 smf_event_remove_from_track(smf_event_t *event)
 {
-	int i, was_last;
-	smf_event_t *tmp;
+	int i, length, was_last = 0;
 	smf_track_t *track;
 
 	assert(event->track != NULL);
 	assert(event->track->smf != NULL);
 
+	if (smf_refuse_if_frozen(event->track->smf, "smf_event_remove_from_track"))
+		return;
+
 	track = event->track;
-	was_last = smf_event_is_last(event);
 
-	/* Adjust ->delta_time_pulses of the next event. */
-	if (event->event_number < track->number_of_events) {
-		tmp = smf_track_get_event_by_number(track, event->event_number + 1);
-		assert(tmp);
-		tmp->delta_time_pulses += event->delta_time_pulses;
-	}
+	/* This might need to find out the length of the song, which takes a while. */
+	if (smf_event_is_tempo_change_or_time_signature(event))
+		was_last = smf_event_is_last(event);
+
+	i = smf_event_index(event);
 
+	/*
+	 * Leave the slot empty; smf_track_renumber_events() squeezes it out later, along with all the others.
+	 * Empty slots at the end are dropped right away, so that the last one always holds an event.
+	 */
+	track->events_array->pdata[i] = NULL;
 	track->number_of_events--;
-	g_ptr_array_remove(track->events_array, event);
 
-	if (track->number_of_events == 0)
-		track->next_event_number = -1;
+	if (i == track->events_array->len - 1) {
+		for (length = i; length > 0 && g_ptr_array_index(track->events_array, length - 1) == NULL; length--)
+			;
+
+		g_ptr_array_set_size(track->events_array, length);
+
+		if (track->first_removed >= length)
+			track->first_removed = -1;
 
-	/* Renumber the rest of the events, so they are consecutively numbered. */
-	for (i = event->event_number; i <= track->number_of_events; i++) {
-		tmp = smf_track_get_event_by_number(track, i);
-		tmp->event_number = i;
+		/* The track ends earlier now. */
+		smf_track_update_length(track);
+
+	} else if (track->first_removed == -1 || i < track->first_removed) {
+		track->first_removed = i;
+	}
+
+	if (track->number_of_events == 0) {
+		track->next_event_number = -1;
+		invalidate_next_event_heap(track->smf);
 	}
 
 	if (smf_event_is_tempo_change_or_time_signature(event)) {
@@ -624,6 +1478,74 @@ smf_event_remove_from_track(smf_event_t *event)
 	event->time_seconds = -1.0;
 }
 
+/**
+ * Removes from the track and frees all the events for which "predicate" returns nonzero.
+ * Unlike calling smf_event_remove_from_track() for each of them, this goes through the track
+ * only once, and the tempo map gets recomputed at most once.  "Predicate" gets called once
+ * for every event, in order; it must not modify the track or look at other events in it.
+ *
+ * \param track Track to remove the events from.
+ * \param predicate Function deciding whether the event should be removed.
+ * \param user_pointer Passed to "predicate".
+ * \return Number of events removed, or -1 if the smf is frozen.
+ */
+int
+smf_track_remove_events_if(smf_track_t *track, smf_event_predicate_t predicate, void *user_pointer)
+{
+	int i, kept = 0, removed, removed_delta = 0, tempo_changed = 0;
+	smf_event_t *event;
+
+	assert(track->smf != NULL);
+	assert(predicate != NULL);
+
+	if (smf_refuse_if_frozen(track->smf, "smf_track_remove_events_if"))
+		return (-1);
+
+	if (smf_track_unshare(track))
+		return (-1);
+
+	smf_track_renumber_events(track);
+
+	for (i = 0; i < track->events_array->len; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		if (predicate(event, user_pointer)) {
+			if (smf_event_is_tempo_change_or_time_signature(event))
+				tempo_changed = 1;
+
+			removed_delta += event->delta_time_pulses;
+
+			event->track = NULL;
+			smf_event_delete(event);
+			continue;
+		}
+
+		event->delta_time_pulses += removed_delta;
+		removed_delta = 0;
+		event->event_number = kept + 1;
+		track->events_array->pdata[kept] = event;
+		kept++;
+	}
+
+	removed = track->events_array->len - kept;
+	if (removed == 0)
+		return (0);
+
+	g_ptr_array_set_size(track->events_array, kept);
+	track->number_of_events = kept;
+	smf_track_update_length(track);
+
+	if (track->number_of_events == 0) {
+		track->next_event_number = -1;
+		invalidate_next_event_heap(track->smf);
+	}
+
+	if (tempo_changed)
+		smf_create_tempo_map_and_compute_seconds(track->smf);
+
+	return (removed);
+}
+
 /**
   * \return Nonzero if event is Tempo Change or Time Signature metaevent.
   */
@@ -654,6 +1576,9 @@ smf_set_format(smf_t *smf, int format)
 {
 	assert(format == 0 || format == 1);
 
+	if (smf_refuse_if_frozen(smf, "smf_set_format"))
+		return (-2);
+
 	if (smf->number_of_tracks > 1 && format == 0) {
 		g_critical("There is more than one track, cannot set format to 0.");
 		return (-1);
@@ -677,21 +1602,20 @@ smf_set_ppqn(smf_t *smf, int ppqn)
 {
 	assert(ppqn > 0);
 
+	if (smf_refuse_if_frozen(smf, "smf_set_ppqn"))
+		return (-1);
+
 	smf->ppqn = ppqn;
 
 	return (0);
 }
 
 /**
-  * Returns next event from the track given and advances next event counter.
-  * Do not depend on End Of Track event being the last event on the track - it
-  * is possible that the track will not end with EOT if you haven't added it
-  * yet.  EOTs are added automatically during smf_save().
-  *
-  * \return Event or NULL, if there are no more events left in this track.
-  */
-smf_event_t *
-smf_track_get_next_event(smf_track_t *track)
+ * Returns the next event from the track and moves the track's next event counter forward.
+ * Does not update smf->next_event_heap; see smf_track_get_next_event().
+ */
+static smf_event_t *
+advance_track(smf_track_t *track)
 {
 	smf_event_t *event, *next_event;
 
@@ -720,6 +1644,30 @@ smf_track_get_next_event(smf_track_t *track)
 	return (event);
 }
 
+/**
+  * Returns next event from the track given and advances next event counter.
+  * Do not depend on End Of Track event being the last event on the track - it
+  * is possible that the track will not end with EOT if you haven't added it
+  * yet.  EOTs are added automatically during smf_save().
+  *
+  * \return Event or NULL, if there are no more events left in this track.
+  */
+smf_event_t *
+smf_track_get_next_event(smf_track_t *track)
+{
+	smf_event_t *event;
+
+	if (smf_refuse_if_frozen(track->smf, "smf_track_get_next_event"))
+		return (NULL);
+
+	event = advance_track(track);
+
+	if (event != NULL && track->smf != NULL)
+		invalidate_next_event_heap(track->smf);
+
+	return (event);
+}
+
 /**
   * Returns next event from the track given.  Does not change next event counter,
   * so repeatedly calling this routine will return the same event.
@@ -744,10 +1692,13 @@ smf_peek_next_event_from_track(smf_track_t *track)
 
 /**
  * \return Track with a given number or NULL, if there is no such track.
- * Tracks are numbered consecutively starting from one.
+ * Tracks are numbered consecutively starting from one.  If the track was loaded using smf_load_lazy()
+ * and not parsed yet, it gets parsed here; if events were removed from it, the remaining ones are moved
+ * together and renumbered.  Therefore, unless the smf is frozen, this must not be called from several
+ * threads at once.
  */
 smf_track_t *
-smf_get_track_by_number(const smf_t *smf, int track_number)
+smf_get_track_by_number(smf_t *smf, int track_number)
 {
 	smf_track_t *track;
 
@@ -756,39 +1707,291 @@ smf_get_track_by_number(const smf_t *smf, int track_number)
 	if (track_number > smf->number_of_tracks)
 		return (NULL);
 
-	track = (smf_track_t *)g_ptr_array_index(smf->tracks_array, track_number - 1);
+	track = (smf_track_t *)g_ptr_array_index(smf->tracks_array, track_number - 1);
+
+	assert(track);
+
+	/* Loaded using smf_load_lazy() and not parsed yet? */
+	if (track->lazy_mtrk != NULL)
+		smf_track_parse_lazy(track);
+
+	/* Events were removed since? */
+	smf_track_renumber_events(track);
+
+	return (track);
+}
+
+/**
+ * Brings event->track_number of the event in the track up to date.  Cheaper than renumbering all
+ * the events after removing or moving tracks.  Events shared with a frozen smf keep their track number.
+ * Event numbers are brought up to date by smf_track_renumber_events().
+ */
+static void
+bring_event_up_to_date(const smf_track_t *track, smf_event_t *event)
+{
+	if (event->track_number != track->track_number && track->shared_track == NULL)
+		event->track_number = track->track_number;
+}
+
+/**
+ * \return Event with a given number or NULL, if there is no such event.
+ * Events are numbered consecutively starting from one.  If events were removed from the track,
+ * the remaining ones are moved together and renumbered first, just like in smf_get_track_by_number().
+ */
+smf_event_t *
+smf_track_get_event_by_number(smf_track_t *track, int event_number)
+{
+	smf_event_t *event;
+
+	assert(event_number >= 1);
+
+	if (event_number > track->number_of_events)
+		return (NULL);
+
+	smf_track_renumber_events(track);
+
+	event = g_ptr_array_index(track->events_array, event_number - 1);
+
+	assert(event);
+
+	bring_event_up_to_date(track, event);
+
+	return (event);
+}
+
+/**
+ * Returns events of the track between "first" and "last" index, after bringing their track numbers up to date.
+ */
+static smf_event_t **
+track_events_in_range(smf_track_t *track, int first, int last, int *number_of_events)
+{
+	int i;
+
+	for (i = first; i < last; i++)
+		bring_event_up_to_date(track, g_ptr_array_index(track->events_array, i));
+
+	*number_of_events = last - first;
+
+	return ((smf_event_t **)track->events_array->pdata + first);
+}
+
+/**
+ * Finds events of the track that happen at or after "from_pulses", but before "to_pulses", using binary
+ * search; it takes time logarithmic in the number of events in the track, plus the number of events found.
+ * Position in the song (see smf_get_next_event()) does not change, so it's fine to call this many times,
+ * e.g. for every frame drawn.
+ *
+ * Events found are next to each other in the track, so they are returned as an array, ordered by time.
+ * The array belongs to the track: do not modify or free it, and do not use it after modifying the track.
+ *
+ * \param track Track.
+ * \param from_pulses Start of the time window.
+ * \param to_pulses End of the time window; events happening exactly then are not included.
+ * \param number_of_events Where to store the number of events found.
+ * \return Array of events found.  Valid only if *number_of_events is not zero.
+ */
+smf_event_t **
+smf_track_get_events_in_range_pulses(smf_track_t *track, int from_pulses, int to_pulses, int *number_of_events)
+{
+	int first, last;
+
+	/* Tracks loaded lazily have no events until parsed. */
+	smf_track_parse_lazy(track);
+	smf_track_renumber_events(track);
+
+	first = smf_track_find_position_pulses(track, from_pulses);
+	last = smf_track_find_position_pulses(track, to_pulses);
+
+	if (last < first)
+		last = first;
+
+	return (track_events_in_range(track, first, last, number_of_events));
+}
+
+/**
+ * Like smf_track_get_events_in_range_pulses(), except that the time window is given in seconds.
+ */
+smf_event_t **
+smf_track_get_events_in_range_seconds(smf_track_t *track, double from_seconds, double to_seconds, int *number_of_events)
+{
+	int first, last;
+
+	smf_track_parse_lazy(track);
+	smf_track_renumber_events(track);
+
+	first = smf_track_find_position_seconds(track, from_seconds);
+	last = smf_track_find_position_seconds(track, to_seconds);
+
+	if (last < first)
+		last = first;
+
+	return (track_events_in_range(track, first, last, number_of_events));
+}
+
+/**
+ * Used by merge_ranges().  Events happening at the same time go in the order of tracks,
+ * like in smf_get_next_event().
+ */
+static int
+range_goes_before(const smf_t *smf, const int *first, int a, int b)
+{
+	const smf_event_t *event_a, *event_b;
+
+	event_a = g_ptr_array_index(((smf_track_t *)g_ptr_array_index(smf->tracks_array, a))->events_array, first[a]);
+	event_b = g_ptr_array_index(((smf_track_t *)g_ptr_array_index(smf->tracks_array, b))->events_array, first[b]);
+
+	if (event_a->time_pulses != event_b->time_pulses)
+		return (event_a->time_pulses < event_b->time_pulses);
+
+	return (a < b);
+}
+
+static void
+range_heap_sift_down(const smf_t *smf, const int *first, int *heap, int heap_length, int i)
+{
+	int child, track_index = heap[i];
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= heap_length)
+			break;
+
+		if (child + 1 < heap_length && range_goes_before(smf, first, heap[child + 1], heap[child]))
+			child++;
+
+		if (!range_goes_before(smf, first, heap[child], track_index))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = track_index;
+}
+
+/**
+ * Merges events between first[i] and last[i] of every track i, in the order smf_get_next_event()
+ * would return them, storing up to "events_length" of them.  Moves first[] forward.
+ * \return Number of events between first[] and last[].
+ */
+static int
+merge_ranges(smf_t *smf, int *first, const int *last, int *heap, smf_event_t **events, int events_length)
+{
+	int i, top, heap_length = 0, found = 0;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	for (i = 0; i < smf->number_of_tracks; i++) {
+		if (first[i] < last[i])
+			heap[heap_length++] = i;
+	}
+
+	for (i = heap_length / 2 - 1; i >= 0; i--)
+		range_heap_sift_down(smf, first, heap, heap_length, i);
+
+	while (heap_length > 0) {
+		/* Once the array is full, the rest only needs counting. */
+		if (found == events_length) {
+			for (i = 0; i < heap_length; i++)
+				found += last[heap[i]] - first[heap[i]];
+
+			break;
+		}
+
+		top = heap[0];
+		track = g_ptr_array_index(smf->tracks_array, top);
+		event = g_ptr_array_index(track->events_array, first[top]);
+
+		bring_event_up_to_date(track, event);
+		events[found++] = event;
+
+		first[top]++;
+		if (first[top] == last[top])
+			heap[0] = heap[--heap_length];
+
+		if (heap_length > 0)
+			range_heap_sift_down(smf, first, heap, heap_length, 0);
+	}
+
+	return (found);
+}
+
+/**
+ * Finds events of all the tracks that happen at or after "from_pulses", but before "to_pulses", and stores
+ * them in "events", in the order smf_get_next_event() would return them.  Takes time proportional to
+ * the number of tracks times logarithm of the number of events, plus the number of events found
+ * times logarithm of the number of tracks.  Position in the song does not change.
+ *
+ * \param smf smf.
+ * \param from_pulses Start of the time window.
+ * \param to_pulses End of the time window; events happening exactly then are not included.
+ * \param events Array to store the events found in.  May be NULL if "events_length" is zero.
+ * \param events_length Size of the array.  Events that do not fit are counted, but not stored.
+ * \return Number of events found, which may be more than "events_length", or -1 if something went wrong.
+ */
+int
+smf_get_events_in_range_pulses(smf_t *smf, int from_pulses, int to_pulses, smf_event_t **events, int events_length)
+{
+	int i, found, *first;
+	smf_track_t *track;
+
+	first = malloc((3 * smf->number_of_tracks + 1) * sizeof(int));
+	if (first == NULL) {
+		g_critical("Cannot allocate memory in smf_get_events_in_range_pulses(): %s", strerror(errno));
+		return (-1);
+	}
+
+	for (i = 0; i < smf->number_of_tracks; i++) {
+		/* This also parses the track, if it was loaded lazily. */
+		track = smf_get_track_by_number(smf, i + 1);
+
+		first[i] = smf_track_find_position_pulses(track, from_pulses);
+		first[smf->number_of_tracks + i] = smf_track_find_position_pulses(track, to_pulses);
+	}
 
-	assert(track);
+	found = merge_ranges(smf, first, first + smf->number_of_tracks, first + 2 * smf->number_of_tracks,
+		events, events_length);
 
-	return (track);
+	free(first);
+
+	return (found);
 }
 
 /**
- * \return Event with a given number or NULL, if there is no such event.
- * Events are numbered consecutively starting from one.
+ * Like smf_get_events_in_range_pulses(), except that the time window is given in seconds.
  */
-smf_event_t *
-smf_track_get_event_by_number(const smf_track_t *track, int event_number)
+int
+smf_get_events_in_range_seconds(smf_t *smf, double from_seconds, double to_seconds, smf_event_t **events, int events_length)
 {
-	smf_event_t *event;
+	int i, found, *first;
+	smf_track_t *track;
 
-	assert(event_number >= 1);
+	first = malloc((3 * smf->number_of_tracks + 1) * sizeof(int));
+	if (first == NULL) {
+		g_critical("Cannot allocate memory in smf_get_events_in_range_seconds(): %s", strerror(errno));
+		return (-1);
+	}
 
-	if (event_number > track->number_of_events)
-		return (NULL);
+	for (i = 0; i < smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i + 1);
 
-	event = g_ptr_array_index(track->events_array, event_number - 1);
+		first[i] = smf_track_find_position_seconds(track, from_seconds);
+		first[smf->number_of_tracks + i] = smf_track_find_position_seconds(track, to_seconds);
+	}
 
-	assert(event);
+	found = merge_ranges(smf, first, first + smf->number_of_tracks, first + 2 * smf->number_of_tracks,
+		events, events_length);
 
-	return (event);
+	free(first);
+
+	return (found);
 }
 
 /**
  * \return Last event on the track or NULL, if track is empty.
  */
 smf_event_t *
-smf_track_get_last_event(const smf_track_t *track)
+smf_track_get_last_event(smf_track_t *track)
 {
 	smf_event_t *event;
 
@@ -801,17 +2004,57 @@ smf_track_get_last_event(const smf_track_t *track)
 }
 
 /**
- * Searches for track that contains next event, in time order.  In other words,
- * returns the track that contains event that should be played next.
- * \return Track with next event or NULL, if there are no events left.
+ * \return Nonzero if the next event of track "a" should be played before the one of track "b".
+ * Events happening at the same time are played in the order of tracks.
  */
-smf_track_t *
-smf_find_track_with_next_event(smf_t *smf)
+static int
+track_goes_before(const smf_track_t *a, const smf_track_t *b)
+{
+	if (a->time_of_next_event != b->time_of_next_event)
+		return (a->time_of_next_event < b->time_of_next_event);
+
+	return (a->track_number < b->track_number);
+}
+
+/**
+ * Moves the track at index "i" of smf->next_event_heap down to where it belongs.
+ */
+static void
+next_event_heap_sift_down(smf_t *smf, int i)
+{
+	int child, len = smf->next_event_heap->len;
+	gpointer *heap = smf->next_event_heap->pdata;
+	gpointer track = heap[i];
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= len)
+			break;
+
+		if (child + 1 < len && track_goes_before(heap[child + 1], heap[child]))
+			child++;
+
+		if (!track_goes_before(heap[child], track))
+			break;
+
+		heap[i] = heap[child];
+		i = child;
+	}
+
+	heap[i] = track;
+}
+
+/**
+ * Puts all the tracks that have events left into smf->next_event_heap.
+ */
+static void
+build_next_event_heap(smf_t *smf)
 {
-	int i, min_time = 0;
-	smf_track_t *track = NULL, *min_time_track = NULL;
+	int i;
+	smf_track_t *track;
+
+	g_ptr_array_set_size(smf->next_event_heap, 0);
 
-	/* Find track with event that should be played next. */
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_get_track_by_number(smf, i);
 
@@ -821,13 +2064,32 @@ smf_find_track_with_next_event(smf_t *smf)
 		if (track->next_event_number == -1)
 			continue;
 
-		if (track->time_of_next_event < min_time || min_time_track == NULL) {
-			min_time = track->time_of_next_event;
-			min_time_track = track;
-		}
+		g_ptr_array_add(smf->next_event_heap, track);
 	}
 
-	return (min_time_track);
+	for (i = smf->next_event_heap->len / 2 - 1; i >= 0; i--)
+		next_event_heap_sift_down(smf, i);
+
+	smf->next_event_heap_is_valid = 1;
+}
+
+/**
+ * Searches for track that contains next event, in time order.  In other words,
+ * returns the track that contains event that should be played next.  Tracks are kept
+ * in a binary heap, so this takes constant time, unless the heap needs to be rebuilt
+ * after tracks were changed other than by smf_get_next_event().
+ * \return Track with next event or NULL, if there are no events left.
+ */
+smf_track_t *
+smf_find_track_with_next_event(smf_t *smf)
+{
+	if (!smf->next_event_heap_is_valid)
+		build_next_event_heap(smf);
+
+	if (smf->next_event_heap->len == 0)
+		return (NULL);
+
+	return (g_ptr_array_index(smf->next_event_heap, 0));
 }
 
 /**
@@ -837,8 +2099,13 @@ smf_event_t *
 smf_get_next_event(smf_t *smf)
 {
 	smf_event_t *event;
-	smf_track_t *track = smf_find_track_with_next_event(smf);
+	smf_track_t *track;
 
+	/* Position in song is a part of the smf. */
+	if (smf_refuse_if_frozen(smf, "smf_get_next_event"))
+		return (NULL);
+
+	track = smf_find_track_with_next_event(smf);
 	if (track == NULL) {
 #if 0
 		g_debug("End of the song.");
@@ -847,11 +2114,20 @@ smf_get_next_event(smf_t *smf)
 		return (NULL);
 	}
 
-	event = smf_track_get_next_event(track);
+	event = advance_track(track);
 	
 	assert(event != NULL);
 
-	event->track->smf->last_seek_position = -1.0;
+	/* The track is at the top of the heap; put it where its next event belongs. */
+	if (track->next_event_number == -1) {
+		smf->next_event_heap->pdata[0] = g_ptr_array_index(smf->next_event_heap, smf->next_event_heap->len - 1);
+		g_ptr_array_set_size(smf->next_event_heap, smf->next_event_heap->len - 1);
+	}
+
+	if (smf->next_event_heap->len > 0)
+		next_event_heap_sift_down(smf, 0);
+
+	smf->last_seek_position = -1.0;
 
 	return (event);
 }
@@ -877,8 +2153,13 @@ smf_event_t *
 smf_peek_next_event(smf_t *smf)
 {
 	smf_event_t *event;
-	smf_track_t *track = smf_find_track_with_next_event(smf);
+	smf_track_t *track;
+
+	/* Position in song is a part of the smf. */
+	if (smf_refuse_if_frozen(smf, "smf_peek_next_event"))
+		return (NULL);
 
+	track = smf_find_track_with_next_event(smf);
 	if (track == NULL) {
 #if 0
 		g_debug("End of the song.");
@@ -907,13 +2188,19 @@ smf_rewind(smf_t *smf)
 
 	assert(smf);
 
+	if (smf_refuse_if_frozen(smf, "smf_rewind"))
+		return;
+
 	smf->last_seek_position = 0.0;
+	invalidate_next_event_heap(smf);
 
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_get_track_by_number(smf, i);
 
 		assert(track != NULL);
 
+		smf_track_renumber_events(track);
+
 		if (track->number_of_events > 0) {
 			track->next_event_number = 1;
 			event = smf_peek_next_event_from_track(track);
@@ -929,34 +2216,96 @@ smf_rewind(smf_t *smf)
 	}
 }
 
+/**
+ * \internal
+ *
+ * Returns index in track->events_array of the first event that does not happen before "seconds".
+ */
+int
+smf_track_find_position_seconds(const smf_track_t *track, double seconds)
+{
+	int low = 0, high = track->events_array->len, middle;
+	smf_event_t *event;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		event = g_ptr_array_index(track->events_array, middle);
+
+		if (event->time_seconds < seconds)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (low);
+}
+
+/**
+ * Makes the event at index "i" in track->events_array the next one smf_get_next_event() returns
+ * from this track.  If "i" is past the end of the track, there will be no more events from it.
+ * \return Nonzero if there are events left in the track.
+ */
+static int
+seek_track_to_index(smf_track_t *track, int i)
+{
+	if (i >= track->events_array->len) {
+		track->next_event_number = -1;
+		return (0);
+	}
+
+	track->next_event_number = i + 1;
+	track->time_of_next_event = ((smf_event_t *)g_ptr_array_index(track->events_array, i))->time_pulses;
+
+	return (1);
+}
+
 /**
   * Seeks the SMF to the given event.  After calling this routine, smf_get_next_event
-  * will return the event that was the second argument of this call.
+  * will return the event that was the second argument of this call.  Each track is positioned
+  * using binary search, so this takes O(tracks * log(events)) time.
   */
 int
 smf_seek_to_event(smf_t *smf, const smf_event_t *target)
 {
-	smf_event_t *event;
+	int i, target_index;
+	smf_track_t *track, *target_track;
 
-	smf_rewind(smf);
+	assert(target->track != NULL);
+
+	if (smf_refuse_if_frozen(smf, "smf_seek_to_event"))
+		return (-1);
+
+	target_track = smf_track_of_event(smf, target);
+	assert(target_track != NULL);
 
 #if 0
-	g_debug("Seeking to event %d, track %d.", target->event_number, target->track->track_number);
+	g_debug("Seeking to event %d, track %d.", target->event_number, target_track->track_number);
 #endif
 
-	for (;;) {
-		event = smf_peek_next_event(smf);
+	smf_track_renumber_events(target_track);
+	target_index = smf_event_index(target);
 
-		/* There can't be NULL here, unless "target" is not in this smf. */
-		assert(event);
+	/*
+	 * Position every track where smf_get_next_event() would be, right before returning "target".
+	 * Events happening at the same time are returned in the order of tracks, so tracks before
+	 * the target's one are past them already, and the tracks after it are not.
+	 */
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
 
-		if (event != target)
-			smf_skip_next_event(smf);
+		assert(track);
+
+		if (track == target_track)
+			seek_track_to_index(track, target_index);
+		else if (track->track_number < target_track->track_number)
+			seek_track_to_index(track, smf_track_find_position_pulses(track, target->time_pulses + 1));
 		else
-			break;
-	}	
+			seek_track_to_index(track, smf_track_find_position_pulses(track, target->time_pulses));
+	}
 
-	smf->last_seek_position = event->time_seconds;
+	invalidate_next_event_heap(smf);
+
+	smf->last_seek_position = target->time_seconds;
 
 	return (0);
 }
@@ -969,10 +2318,14 @@ smf_seek_to_event(smf_t *smf, const smf_event_t *target)
 int
 smf_seek_to_seconds(smf_t *smf, double seconds)
 {
-	smf_event_t *event;
+	int i, events_left = 0;
+	smf_track_t *track;
 
 	assert(seconds >= 0.0);
 
+	if (smf_refuse_if_frozen(smf, "smf_seek_to_seconds"))
+		return (-2);
+
 	if (seconds == smf->last_seek_position) {
 #if 0
 		g_debug("Avoiding seek to %f seconds.", seconds);
@@ -980,24 +2333,24 @@ smf_seek_to_seconds(smf_t *smf, double seconds)
 		return (0);
 	}
 
-	smf_rewind(smf);
-
 #if 0
 	g_debug("Seeking to %f seconds.", seconds);
 #endif
 
-	for (;;) {
-		event = smf_peek_next_event(smf);
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
 
-		if (event == NULL) {
-			g_critical("Trying to seek past the end of song.");
-			return (-1);
-		}
+		assert(track);
 
-		if (event->time_seconds < seconds)
-			smf_skip_next_event(smf);
-		else
-			break;
+		events_left |= seek_track_to_index(track, smf_track_find_position_seconds(track, seconds));
+	}
+
+	invalidate_next_event_heap(smf);
+
+	if (!events_left) {
+		g_critical("Trying to seek past the end of song.");
+		smf->last_seek_position = -1.0;
+		return (-1);
 	}
 
 	smf->last_seek_position = seconds;
@@ -1013,88 +2366,265 @@ smf_seek_to_seconds(smf_t *smf, double seconds)
 int
 smf_seek_to_pulses(smf_t *smf, int pulses)
 {
-	smf_event_t *event;
+	int i, events_left = 0;
+	smf_track_t *track;
 
 	assert(pulses >= 0);
 
-	smf_rewind(smf);
+	if (smf_refuse_if_frozen(smf, "smf_seek_to_pulses"))
+		return (-2);
 
 #if 0
 	g_debug("Seeking to %d pulses.", pulses);
 #endif
 
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
+
+		assert(track);
+
+		events_left |= seek_track_to_index(track, smf_track_find_position_pulses(track, pulses));
+	}
+
+	invalidate_next_event_heap(smf);
+
+	if (!events_left) {
+		g_critical("Trying to seek past the end of song.");
+		smf->last_seek_position = -1.0;
+		return (-1);
+	}
+
+	smf->last_seek_position = smf_peek_next_event(smf)->time_seconds;
+
+	return (0);
+}
+
+/**
+ * \return Last event of the track, which must not be empty.  Unlike smf_track_get_last_event(),
+ * does not renumber anything; the last slot of events_array is never empty.
+ */
+static const smf_event_t *
+track_last_event(const smf_track_t *track)
+{
+	const smf_event_t *event;
+
+	assert(track->events_array->len > 0);
+
+	event = g_ptr_array_index(track->events_array, track->events_array->len - 1);
+	assert(event != NULL);
+
+	return (event);
+}
+
+/**
+ * \return Nonzero if the last event of track "a" happens after the last event of track "b".
+ */
+static int
+track_ends_after(const smf_track_t *a, const smf_track_t *b)
+{
+	const smf_event_t *last_a = track_last_event(a), *last_b = track_last_event(b);
+
+	if (last_a->time_pulses != last_b->time_pulses)
+		return (last_a->time_pulses > last_b->time_pulses);
+
+	return (last_a->time_seconds > last_b->time_seconds);
+}
+
+/**
+ * Puts the track at index "i" of smf->length_heap.
+ */
+static void
+length_heap_set(smf_t *smf, int i, smf_track_t *track)
+{
+	smf->length_heap->pdata[i] = track;
+	track->length_heap_index = i;
+}
+
+/**
+ * Moves the track at index "i" of smf->length_heap up to where it belongs.
+ */
+static void
+length_heap_sift_up(smf_t *smf, int i)
+{
+	int parent;
+	smf_track_t *track = g_ptr_array_index(smf->length_heap, i);
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+
+		if (!track_ends_after(track, g_ptr_array_index(smf->length_heap, parent)))
+			break;
+
+		length_heap_set(smf, i, g_ptr_array_index(smf->length_heap, parent));
+		i = parent;
+	}
+
+	length_heap_set(smf, i, track);
+}
+
+/**
+ * Moves the track at index "i" of smf->length_heap down to where it belongs.
+ */
+static void
+length_heap_sift_down(smf_t *smf, int i)
+{
+	int child, len = smf->length_heap->len;
+	smf_track_t *track = g_ptr_array_index(smf->length_heap, i);
+
 	for (;;) {
-		event = smf_peek_next_event(smf);
+		child = 2 * i + 1;
+		if (child >= len)
+			break;
 
-		if (event == NULL) {
-			g_critical("Trying to seek past the end of song.");
-			return (-1);
-		}
+		if (child + 1 < len && track_ends_after(g_ptr_array_index(smf->length_heap, child + 1),
+			g_ptr_array_index(smf->length_heap, child)))
+			child++;
 
-		if (event->time_pulses < pulses)
-			smf_skip_next_event(smf);
-		else
+		if (!track_ends_after(g_ptr_array_index(smf->length_heap, child), track))
 			break;
+
+		length_heap_set(smf, i, g_ptr_array_index(smf->length_heap, child));
+		i = child;
 	}
 
-	smf->last_seek_position = event->time_seconds;
+	length_heap_set(smf, i, track);
+}
 
-	return (0);
+/**
+ * Takes the track out of smf->length_heap.
+ */
+static void
+length_heap_remove(smf_t *smf, smf_track_t *track)
+{
+	int i = track->length_heap_index;
+	smf_track_t *last;
+
+	assert(i >= 0 && i < smf->length_heap->len);
+	assert(g_ptr_array_index(smf->length_heap, i) == track);
+
+	track->length_heap_index = -1;
+
+	last = g_ptr_array_index(smf->length_heap, smf->length_heap->len - 1);
+	g_ptr_array_set_size(smf->length_heap, smf->length_heap->len - 1);
+
+	if (last == track)
+		return;
+
+	length_heap_set(smf, i, last);
+	length_heap_sift_up(smf, i);
+	length_heap_sift_down(smf, last->length_heap_index);
 }
 
 /**
-  * \return Length of SMF, in pulses.
-  */
-int
-smf_get_length_pulses(const smf_t *smf)
+ * \internal
+ *
+ * Builds smf->length_heap from scratch, out of all the tracks that have events.  Tracks loaded
+ * using smf_load_lazy() and not parsed yet are left out; they get added when they are parsed.
+ */
+void
+smf_build_length_heap(smf_t *smf)
 {
-	int pulses = 0, i;
+	int i;
+	smf_track_t *track;
 
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		smf_track_t *track;
-		smf_event_t *event;
+	g_ptr_array_set_size(smf->length_heap, 0);
 
-	       	track = smf_get_track_by_number(smf, i);
-		assert(track);
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+		track->length_heap_index = -1;
 
-		event = smf_track_get_last_event(track);
-		/* Empty track? */
-		if (event == NULL)
+		if (track->number_of_events == 0)
 			continue;
 
-		if (event->time_pulses > pulses)
-			pulses = event->time_pulses;
+		g_ptr_array_add(smf->length_heap, track);
+		track->length_heap_index = smf->length_heap->len - 1;
 	}
 
-	return (pulses);
+	for (i = smf->length_heap->len / 2 - 1; i >= 0; i--)
+		length_heap_sift_down(smf, i);
+
+	smf->length_heap_is_valid = 1;
 }
 
 /**
-  * \return Length of SMF, in seconds.
-  */
-double
-smf_get_length_seconds(const smf_t *smf)
+ * \internal
+ *
+ * Moves the track to its place in smf->length_heap, after its last event was added, removed
+ * or had its time changed, or the track was added to the smf.  Takes O(log(number of tracks)).
+ * Does nothing if the heap is not valid, so it's safe to call from the loader threads.
+ */
+void
+smf_track_update_length(smf_track_t *track)
 {
+	smf_t *smf = track->smf;
 	int i;
-	double seconds = 0.0;
 
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		smf_track_t *track;
-		smf_event_t *event;
+	if (smf == NULL || !smf->length_heap_is_valid)
+		return;
 
-	       	track = smf_get_track_by_number(smf, i);
-		assert(track);
+	i = track->length_heap_index;
 
-		event = smf_track_get_last_event(track);
-		/* Empty track? */
-		if (event == NULL)
-			continue;
+	if (track->number_of_events == 0) {
+		if (i != -1)
+			length_heap_remove(smf, track);
+
+		return;
+	}
 
-		if (event->time_seconds > seconds)
-			seconds = event->time_seconds;
+	if (i == -1) {
+		g_ptr_array_add(smf->length_heap, track);
+		i = smf->length_heap->len - 1;
 	}
 
-	return (seconds);
+	length_heap_sift_up(smf, i);
+	length_heap_sift_down(smf, track->length_heap_index);
+}
+
+/**
+ * Parses tracks loaded using smf_load_lazy(), if there are any left, and builds smf->length_heap,
+ * if it's not valid.  Neither happens for frozen smfs.
+ */
+static void
+prepare_length_heap(smf_t *smf)
+{
+	int i;
+
+	for (i = 0; smf->number_of_lazy_tracks > 0 && i < smf->tracks_array->len; i++)
+		smf_track_parse_lazy(g_ptr_array_index(smf->tracks_array, i));
+
+	if (!smf->length_heap_is_valid)
+		smf_build_length_heap(smf);
+}
+
+/**
+  * \return Length of SMF, in pulses.  The time of the last event of every track is kept in a heap,
+  * so this takes constant time, except for the first call after the smf was loaded using smf_load_lazy()
+  * or created using smf_new(), which parses the remaining tracks or builds the heap.  Like
+  * smf_get_track_by_number(), it's not safe to call from several threads at once, unless the smf is frozen.
+  */
+int
+smf_get_length_pulses(smf_t *smf)
+{
+	prepare_length_heap(smf);
+
+	if (smf->length_heap->len == 0)
+		return (0);
+
+	return (track_last_event(g_ptr_array_index(smf->length_heap, 0))->time_pulses);
+}
+
+/**
+  * \return Length of SMF, in seconds.  See smf_get_length_pulses().
+  */
+double
+smf_get_length_seconds(smf_t *smf)
+{
+	prepare_length_heap(smf);
+
+	if (smf->length_heap->len == 0)
+		return (0.0);
+
+	return (track_last_event(g_ptr_array_index(smf->length_heap, 0))->time_seconds);
 }
 
 /**
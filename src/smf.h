@@ -121,6 +121,52 @@
  * do smf_get_next_event() in loop, until it returns NULL.  Calling smf_load() causes the smf to be rewound
  * to the start of the song.
  *
+ * smf_get_next_event() and friends keep the position inside the smf, so there can be only one.  If you need
+ * more, e.g. for a playback thread and a preview in the user interface, use cursors: smf_cursor_new(),
+ * smf_cursor_get_next_event(), smf_cursor_seek_to_seconds() and so on.  Cursors never modify the smf, so
+ * several threads may read one song through their own cursors at the same time.  To make sure nobody
+ * modifies the song meanwhile, share a snapshot made by smf_freeze(); it is read-only and reference counted.
+ * smf_save() does not modify the contents of the smf either, so a snapshot can be saved while the song
+ * is being edited.
+ *
+ * Some functions that only read the song still do some work on it: smf_get_track_by_number(),
+ * smf_track_get_event_by_number(), smf_get_length_pulses(), the range queries and smf_save() parse tracks
+ * loaded using smf_load_lazy() and, after events were removed, move the remaining ones together and
+ * renumber them.
+ * Therefore, unless the smf is frozen, no two threads may call any libsmf functions on it at the same
+ * time, even if neither of them changes the song.  Frozen smfs are never modified, so these functions
+ * are safe to call on them from any number of threads.
+ *
+ * To get all the events within some time window, e.g. to draw a piano roll or to play a loop, use
+ * smf_track_get_events_in_range_pulses() or smf_get_events_in_range_pulses(), or their "_seconds" variants.
+ * They use binary search, and do not change the position in the song.
+ *
+ * To scan many events of a track at once, e.g. to find all the notes or to look up times in bulk,
+ * make a columnar copy of it using smf_columns_new(): arrays of times and status bytes, and all the
+ * MIDI messages in one block, which is much faster to go through than events one by one.
+ *
+ * If you only need some of the tracks, use smf_load_lazy() instead of smf_load().  It reads the MThd header
+ * and builds the tempo map, but parses tracks into events only when they are first used, e.g. by
+ * smf_get_track_by_number() or smf_get_next_event().  Note that smf_get_length_pulses(), smf_save() and
+ * the like use all the tracks, so they will parse all of them.
+ *
+ * Big files with many tracks can be loaded faster using smf_load_parallel(), which parses tracks
+ * using several threads.  The result is the same as with smf_load().  If you need only some of the events,
+ * e.g. notes on certain channels, use smf_load_with_options(); events you don't want are skipped without
+ * allocating anything for them.  To load many files, use smf_load_many()
+ * or smf_load_many_with_callback(); they load several files at once, each one in its own thread.
+ * smf_load_many() keeps every loaded file until it returns, so its memory use grows with the number
+ * of files.  smf_load_many_with_callback() is the bounded-memory way: every worker thread passes its smf
+ * to the callback and waits for it to return before loading the next file, so if the callback calls
+ * smf_delete() on every smf it gets, no more than "number_of_threads" files are in memory at a time.
+ *
+ * To get just the MThd information, the list of chunks and, optionally, track names and tempo changes,
+ * without loading the file, use smf_probe().  It does not create any events, so it is much faster.
+ *
+ * When the file arrives in pieces, e.g. from a pipe or a socket, use smf_parser_new() and pass the pieces
+ * to smf_parser_feed() as they come.  Events are added to tracks and passed to your callback as soon
+ * as they are complete; smf_parser_finish() returns the smf at the end.
+ *
  * Getting events by number works like this:
  *
  * \code
@@ -144,35 +190,45 @@
  * them.  If you need to create MIDI message that takes only two bytes, pass -1 as the third byte.
  * For one byte message (System Realtime), pass -1 as second and third byte.
  *
- * To free an event, use smf_event_delete().
+ * To free an event, use smf_event_delete().  Short MIDI messages are stored inside the event itself, and events
+ * loaded from file keep their MIDI data in storage allocated in large blocks, so never free(3) event->midi_buffer
+ * of an event you didn't fill yourself; if you need to replace it, simply assign new, malloc(3)-allocated buffer
+ * to event->midi_buffer.
  *
  * To add event to the track, use smf_track_add_event_delta_pulses(), smf_track_add_event_pulses(),
  * or smf_track_add_event_seconds().  The difference between them is in the way you specify the time of
  * the event - with the first one, you specify it as an interval, in pulses, from the previous event
  * in this track; with the second one, you specify it as pulses from the start of the song, and with the
  * last one, you specify it as seconds from the start of the song.  Obviously, the first version can
- * only append events at the end of the track.
+ * only append events at the end of the track.  To add many events at once, e.g. a recorded take, use
+ * smf_track_add_events(); it is much faster than adding them one by one.
  *
  * To remove an event from the track it's attached to, use smf_event_remove_from_track().  You may
- * want to free the event (using smf_event_delete()) afterwards.
+ * want to free the event (using smf_event_delete()) afterwards.  To remove and free all the events
+ * matching some condition, use smf_track_remove_events_if(); it goes through the track only once.
+ * After many edits, smf_compact() puts events of every track back next to each other in memory,
+ * which makes playing them faster.
+ *
+ * To make a copy of the whole smf, e.g. to be able to undo an edit, use smf_clone().  To make many variants
+ * of one song cheaply, freeze it and use smf_clone_shared(); variants share tracks until they get modified.
  *
  * To create new track, use smf_track_new().  To add track to the smf, use smf_add_track().
  * To remove track from its smf, use smf_track_remove_from_smf().  To free the track structure,
- * use smf_track_delete().
+ * use smf_track_delete().  To change the order of tracks, use smf_track_move().
  *
  * Note that libsmf keeps things consistent.  If you free (using smf_track_delete()) a track that
  * is attached to an smf and contains events, libsmf will detach the events, free them, detach
  * the track, free it etc.
  *
  * Tracks and events are numbered consecutively, starting from one.  If you remove a track or event,
- * the rest of tracks/events will get renumbered.  To get the number of a given event in its track, use event->event_number.
+ * the rest of tracks/events will get renumbered; for events, that happens lazily - see event->event_number.  To get the number of a given event in its track, use event->event_number.
  * To get the number of track in its smf, use track->track_number.  To get the number of events in the track,
  * use track->number_of_events.  To get the number of tracks in the smf, use smf->number_of_tracks.
  *
  * In SMF File Format, each track has to end with End Of Track metaevent.  If you load SMF file using smf_load(),
  * that will be the case.  If you want to create or edit an SMF, you don't need to worry about EOT events;
  * libsmf automatically takes care of them for you.  If you try to save an SMF with tracks that do not end
- * with EOTs, smf_save() will append them.  If you try to add event that happens after EOT metaevent, libsmf
+ * with EOTs, smf_save() will write them to the file, without adding them to the smf.  If you try to add event that happens after EOT metaevent, libsmf
  * will remove the EOT.  If you want to add EOT manually, you can, of course, using smf_track_add_eot_seconds()
  * or smf_track_add_eot_pulses().
  *
@@ -226,6 +282,11 @@ extern "C" {
 #define WARN_UNUSED_RESULT
 #endif
 
+struct smf_arena_struct;
+
+/** MIDI messages up to this length are stored inside smf_event_t, instead of separately allocated buffer. */
+#define SMF_INLINE_BUFFER_LENGTH	4
+
 /** Represents a "song", that is, collection of one or more tracks. */
 struct smf_struct {
 	int		format;
@@ -236,17 +297,39 @@ struct smf_struct {
 	int		resolution;
 	int		number_of_tracks;
 
-	/** These are private fields using only by loading and saving routines. */
+	/** These are private fields using only by loading routines. */
 	FILE		*stream;
 	void		*file_buffer;
 	int		file_buffer_length;
 	int		next_chunk_offset;
 	int		expected_number_of_tracks;
 
+	/** Private, used by smf_load_lazy().  Buffer the unparsed tracks point into; NULL if not owned by smf. */
+	void		*lazy_buffer;
+	int		lazy_buffer_length;
+	int		lazy_buffer_mapped;
+	int		number_of_lazy_tracks;
+
 	/** Private, used by smf.c. */
 	GPtrArray	*tracks_array;
 	double		last_seek_position;
 
+	/** Private, used by smf.c.  Tracks with events left to play, as a binary heap ordered by
+	    time of the next event and track number; see smf_find_track_with_next_event(). */
+	GPtrArray	*next_event_heap;
+	int		next_event_heap_is_valid;
+
+	/** Private, used by smf_freeze.c.  Nonzero if this smf was made by smf_freeze() and cannot be modified. */
+	int		frozen;
+
+	/** Private, used by smf_freeze.c.  Number of references to the frozen smf; see smf_ref(). */
+	int		reference_count;
+
+	/** Private, used by smf.c.  Tracks that have events, as a binary heap ordered by time of their
+	    last event, latest first; see smf_get_length_pulses(). */
+	GPtrArray	*length_heap;
+	int		length_heap_is_valid;
+
 	/** Private, used by smf_tempo.c. */
 	/** Array of pointers to smf_tempo_struct. */
 	GPtrArray	*tempo_array;
@@ -274,20 +357,35 @@ struct smf_track_struct {
 	int		track_number;
 	int		number_of_events;
 
-	/** These are private fields using only by loading and saving routines. */
+	/** These are private fields using only by loading routines. */
 	void		*file_buffer;
 	int		file_buffer_length;
-	int		last_status; /* Used for "running status". */
+
+	/** MTrk chunk of the track loaded using smf_load_lazy(), or NULL if the track was already parsed. */
+	void		*lazy_mtrk;
+	int		lazy_mtrk_length;
 
 	/** Private, used by smf.c. */
-	/** Offset into buffer, used in parse_next_event(). */
-	int		next_event_offset;
 	int		next_event_number;
 
+	/** Private, used by smf.c.  Index of the first slot in events_array left empty (NULL) by
+	    smf_event_remove_from_track(), or -1 if there are none; see smf_track_renumber_events(). */
+	int		first_removed;
+
+	/** Private, used by smf.c.  Index of the track in smf->length_heap, or -1 if it's not there. */
+	int		length_heap_index;
+
 	/** Absolute time of next event on events_queue. */
 	int		time_of_next_event;
 	GPtrArray	*events_array;
 
+	/** Private, used by smf_load.c.  Storage for events loaded from file; see smf_arena.c. */
+	struct smf_arena_struct	*arena;
+
+	/** Private, used by smf.c.  Track of a frozen smf whose events_array this track uses until
+	    it's modified for the first time, or NULL if the track has events of its own; see smf_clone_shared(). */
+	struct smf_track_struct	*shared_track;
+
 	/** API consumer is free to use this for whatever purpose.  NULL in freshly allocated track.
 	    Note that tracks might be deallocated not only explicitly, by calling smf_track_delete(),
 	    but also implicitly, e.g. when calling smf_delete() with tracks still added to
@@ -302,20 +400,30 @@ struct smf_event_struct {
 	/** Pointer to the track, or NULL if event is not attached. */
 	smf_track_t	*track;
 
-	/** Number of this event in the track.  Events are numbered consecutively, starting from one. */
+	/** Number of this event in the track.  Events are numbered consecutively, starting from one.
+	    Removing an event does not renumber the ones after it right away; their numbers are brought
+	    up to date when libsmf returns them (e.g. from smf_track_get_event_by_number() or
+	    smf_get_next_event()), or for the whole song by smf_rewind(). */
 	int		event_number;
 
 	/** Note that the time fields are invalid, if event is not attached to a track. */
-	/** Time, in pulses, since the previous event on this track. */
+	/** Time, in pulses, since the previous event on this track.  Like event_number, it's brought
+	    up to date after removing the previous event when libsmf returns the event. */
 	int		delta_time_pulses;
 
 	/** Time, in pulses, since the start of the song. */
 	int		time_pulses;
 
+	/** Private.  If the event was allocated from an arena, distance in bytes from the start of the arena
+	    block holding it, which leads to the arena; zero if the event was allocated using malloc(3). */
+	int		arena_offset;
+
 	/** Time, in seconds, since the start of the song. */
 	double		time_seconds;
 
-	/** Tracks are numbered consecutively, starting from 1. */
+	/** Tracks are numbered consecutively, starting from 1.  Removing or moving a track does not
+	    update this in every event right away; like event_number, it is brought up to date when
+	    libsmf returns the event.  event->track->track_number is always current. */
 	int		track_number;
 
 	/** Pointer to the buffer containing MIDI message.  This is freed by smf_event_delete. */
@@ -324,6 +432,9 @@ struct smf_event_struct {
 	/** Length of the MIDI message in the buffer, in bytes. */
 	int		midi_buffer_length; 
 
+	/** Private.  Short messages are kept here, with event->midi_buffer pointing to it. */
+	unsigned char	inline_buffer[SMF_INLINE_BUFFER_LENGTH];
+
 	/** API consumer is free to use this for whatever purpose.  NULL in freshly allocated event.
 	    Note that events might be deallocated not only explicitly, by calling smf_event_delete(),
 	    but also implicitly, e.g. when calling smf_track_delete() with events still added to
@@ -333,16 +444,134 @@ struct smf_event_struct {
 
 typedef struct smf_event_struct smf_event_t;
 
+/** Read cursor, see smf_cursor_new().  Fields are private. */
+typedef struct smf_cursor_struct smf_cursor_t;
+
+/** Events of a track stored column by column, see smf_columns_new().  Fields are read-only. */
+struct smf_columns_struct {
+	int		number_of_events;
+
+	/** Time of every event, in pulses and in seconds, in the order of events in the track. */
+	int		*time_pulses;
+	double		*time_seconds;
+
+	/** First byte of every MIDI message, e.g. 0x90 for Note On on channel 1 or 0xFF for metaevents. */
+	unsigned char	*status;
+
+	/** MIDI message of the event at index "i" takes payload_offset[i + 1] - payload_offset[i] bytes
+	    of the payload, starting at payload_offset[i].  There are number_of_events + 1 offsets. */
+	int		*payload_offset;
+	unsigned char	*payload;
+};
+
+typedef struct smf_columns_struct smf_columns_t;
+
+/** Incremental SMF parser, see smf_parser_new().  Fields are private. */
+typedef struct smf_parser_struct smf_parser_t;
+
+/** Called by the parser for every event it adds to a track. */
+typedef void (*smf_parser_callback_t)(smf_event_t *event, void *user_pointer);
+
+/** Options for smf_load_with_options().  Initialize them using smf_load_options_init() before changing. */
+struct smf_load_options_struct {
+	/** Bit (N - 1) selects track number N.  From tracks that are not selected, only the Tempo Change,
+	    Time Signature and End Of Track metaevents get loaded, so the tempo map and track numbers stay
+	    the same.  Tracks after the 64th are selected iff the last bit is.  Default: all bits set. */
+	guint64		track_mask;
+
+	/** Bit N selects MIDI channel N (0-15).  Channel messages on other channels are skipped.  Default: 0xFFFF. */
+	unsigned int	channel_mask;
+
+	/** Classes of events to skip, ORed SMF_LOAD_SKIP_* flags.  Default: 0. */
+	int		skip_events;
+
+	/** Number of threads parsing tracks, or zero for one thread per processor.  Default: 1. */
+	int		number_of_threads;
+};
+
+typedef struct smf_load_options_struct smf_load_options_t;
+
+/** Flags for smf_load_options_t.skip_events.  Tempo Change, Time Signature and End Of Track are never skipped. */
+#define SMF_LOAD_SKIP_SYSEX		0x01	/* System Exclusive. */
+#define SMF_LOAD_SKIP_SYSTEM		0x02	/* System Common, System Realtime and escaped events. */
+#define SMF_LOAD_SKIP_METADATA		0x04	/* Metaevents. */
+#define SMF_LOAD_SKIP_CONTROLLERS	0x08	/* Control Change. */
+
+/** Describes a single chunk of SMF file, as found by smf_probe(). */
+struct smf_probe_chunk_struct {
+	/** Chunk signature, e.g. "MTrk", NUL-terminated. */
+	char		id[5];
+
+	/** Offset of the chunk header from the start of the file, in bytes. */
+	int		offset;
+
+	/** Length of the chunk, without the header, as declared in the header. */
+	int		length;
+
+	/** Nonzero if the file ends before the end of the chunk. */
+	int		truncated;
+
+	/** Track number this MTrk chunk would get after loading, or 0 for other chunks. */
+	int		track_number;
+
+	/** These are filled only with SMF_PROBE_META.  Name of the track (NULL if none), number of events,
+	    time of the last event and nonzero if the chunk could not be parsed up to the End Of Track. */
+	char		*track_name;
+	int		number_of_events;
+	int		length_pulses;
+	int		malformed;
+};
+
+typedef struct smf_probe_chunk_struct smf_probe_chunk_t;
+
+/** Tempo Change metaevent found by smf_probe(). */
+struct smf_probe_tempo_struct {
+	int		track_number;
+	int		time_pulses;
+	int		microseconds_per_quarter_note;
+};
+
+typedef struct smf_probe_tempo_struct smf_probe_tempo_t;
+
+/** Information about SMF file, extracted without loading it; see smf_probe(). */
+struct smf_probe_struct {
+	/** These are extracted from MThd header, just like in smf_t. */
+	int		format;
+	int		ppqn;
+	int		frames_per_second;
+	int		resolution;
+	int		expected_number_of_tracks;
+
+	/** Number of MTrk chunks among the chunks; that is, number of tracks smf_load() would load. */
+	int		number_of_tracks;
+
+	/** Chunks following MThd, in file order. */
+	smf_probe_chunk_t	*chunks;
+	int		number_of_chunks;
+
+	/** Tempo Change metaevents, in file order; filled only with SMF_PROBE_META. */
+	smf_probe_tempo_t	*tempos;
+	int		number_of_tempos;
+};
+
+typedef struct smf_probe_struct smf_probe_t;
+
+/** Flag for smf_probe(): scan MTrk chunks for track names and tempo changes. */
+#define SMF_PROBE_META	0x01
+
 /* Routines for manipulating smf_t. */
 smf_t *smf_new(void) WARN_UNUSED_RESULT;
 void smf_delete(smf_t *smf);
+smf_t *smf_clone(smf_t *smf) WARN_UNUSED_RESULT;
+smf_t *smf_clone_shared(smf_t *smf) WARN_UNUSED_RESULT;
+int smf_compact(smf_t *smf) WARN_UNUSED_RESULT;
 
 int smf_set_format(smf_t *smf, int format) WARN_UNUSED_RESULT;
 int smf_set_ppqn(smf_t *smf, int format) WARN_UNUSED_RESULT;
 
 char *smf_decode(const smf_t *smf) WARN_UNUSED_RESULT;
 
-smf_track_t *smf_get_track_by_number(const smf_t *smf, int track_number) WARN_UNUSED_RESULT;
+smf_track_t *smf_get_track_by_number(smf_t *smf, int track_number) WARN_UNUSED_RESULT;
 
 smf_event_t *smf_peek_next_event(smf_t *smf) WARN_UNUSED_RESULT;
 smf_event_t *smf_get_next_event(smf_t *smf) WARN_UNUSED_RESULT;
@@ -352,30 +581,66 @@ void smf_rewind(smf_t *smf);
 int smf_seek_to_seconds(smf_t *smf, double seconds) WARN_UNUSED_RESULT;
 int smf_seek_to_pulses(smf_t *smf, int pulses) WARN_UNUSED_RESULT;
 int smf_seek_to_event(smf_t *smf, const smf_event_t *event) WARN_UNUSED_RESULT;
-
-int smf_get_length_pulses(const smf_t *smf) WARN_UNUSED_RESULT;
-double smf_get_length_seconds(const smf_t *smf) WARN_UNUSED_RESULT;
+int smf_get_events_in_range_pulses(smf_t *smf, int from_pulses, int to_pulses, smf_event_t **events, int events_length);
+int smf_get_events_in_range_seconds(smf_t *smf, double from_seconds, double to_seconds, smf_event_t **events, int events_length);
+
+/* Routines for read-only snapshots. */
+smf_t *smf_freeze(smf_t *smf) WARN_UNUSED_RESULT;
+smf_t *smf_ref(smf_t *smf);
+int smf_is_frozen(const smf_t *smf) WARN_UNUSED_RESULT;
+
+/* Routines for reading the song without changing its position. */
+smf_cursor_t *smf_cursor_new(smf_t *smf) WARN_UNUSED_RESULT;
+void smf_cursor_delete(smf_cursor_t *cursor);
+void smf_cursor_rewind(smf_cursor_t *cursor);
+smf_event_t *smf_cursor_get_next_event(smf_cursor_t *cursor) WARN_UNUSED_RESULT;
+smf_event_t *smf_cursor_peek_next_event(const smf_cursor_t *cursor) WARN_UNUSED_RESULT;
+int smf_cursor_seek_to_seconds(smf_cursor_t *cursor, double seconds) WARN_UNUSED_RESULT;
+int smf_cursor_seek_to_pulses(smf_cursor_t *cursor, int pulses) WARN_UNUSED_RESULT;
+int smf_cursor_seek_to_event(smf_cursor_t *cursor, const smf_event_t *event) WARN_UNUSED_RESULT;
+
+/* Routines for columnar copies of tracks. */
+smf_columns_t *smf_columns_new(smf_track_t *track) WARN_UNUSED_RESULT;
+void smf_columns_delete(smf_columns_t *columns);
+smf_event_t *smf_columns_get_event(const smf_columns_t *columns, int index) WARN_UNUSED_RESULT;
+int smf_columns_find_position_pulses(const smf_columns_t *columns, int pulses) WARN_UNUSED_RESULT;
+int smf_columns_find_position_seconds(const smf_columns_t *columns, double seconds) WARN_UNUSED_RESULT;
+int smf_columns_select_status(const smf_columns_t *columns, unsigned char mask, unsigned char value, int *indexes);
+
+int smf_get_length_pulses(smf_t *smf) WARN_UNUSED_RESULT;
+double smf_get_length_seconds(smf_t *smf) WARN_UNUSED_RESULT;
 int smf_event_is_last(const smf_event_t *event) WARN_UNUSED_RESULT;
 
 void smf_add_track(smf_t *smf, smf_track_t *track);
 void smf_track_remove_from_smf(smf_track_t *track);
+int smf_track_move(smf_track_t *track, int track_number) WARN_UNUSED_RESULT;
 
 /* Routines for manipulating smf_track_t. */
 smf_track_t *smf_track_new(void) WARN_UNUSED_RESULT;
 void smf_track_delete(smf_track_t *track);
+int smf_track_unshare(smf_track_t *track) WARN_UNUSED_RESULT;
+int smf_track_compact(smf_track_t *track) WARN_UNUSED_RESULT;
 
 smf_event_t *smf_track_get_next_event(smf_track_t *track) WARN_UNUSED_RESULT;
-smf_event_t *smf_track_get_event_by_number(const smf_track_t *track, int event_number) WARN_UNUSED_RESULT;
-smf_event_t *smf_track_get_last_event(const smf_track_t *track) WARN_UNUSED_RESULT;
+smf_event_t *smf_track_get_event_by_number(smf_track_t *track, int event_number) WARN_UNUSED_RESULT;
+smf_event_t *smf_track_get_last_event(smf_track_t *track) WARN_UNUSED_RESULT;
+smf_event_t **smf_track_get_events_in_range_pulses(smf_track_t *track, int from_pulses, int to_pulses, int *number_of_events) WARN_UNUSED_RESULT;
+smf_event_t **smf_track_get_events_in_range_seconds(smf_track_t *track, double from_seconds, double to_seconds, int *number_of_events) WARN_UNUSED_RESULT;
 
 void smf_track_add_event_delta_pulses(smf_track_t *track, smf_event_t *event, int pulses);
 void smf_track_add_event_pulses(smf_track_t *track, smf_event_t *event, int pulses);
 void smf_track_add_event_seconds(smf_track_t *track, smf_event_t *event, double seconds);
+void smf_track_add_events(smf_track_t *track, smf_event_t **events, const int *pulses, int number_of_events);
 int smf_track_add_eot_delta_pulses(smf_track_t *track, int delta) WARN_UNUSED_RESULT;
 int smf_track_add_eot_pulses(smf_track_t *track, int pulses) WARN_UNUSED_RESULT;
 int smf_track_add_eot_seconds(smf_track_t *track, double seconds) WARN_UNUSED_RESULT;
 void smf_event_remove_from_track(smf_event_t *event);
 
+/** Called by smf_track_remove_events_if() for every event; nonzero return value means "remove it". */
+typedef int (*smf_event_predicate_t)(const smf_event_t *event, void *user_pointer);
+
+int smf_track_remove_events_if(smf_track_t *track, smf_event_predicate_t predicate, void *user_pointer);
+
 /* Routines for manipulating smf_event_t. */
 smf_event_t *smf_event_new(void) WARN_UNUSED_RESULT;
 smf_event_t *smf_event_new_from_pointer(void *midi_data, int len) WARN_UNUSED_RESULT;
@@ -396,6 +661,37 @@ char *smf_event_extract_text(const smf_event_t *event) WARN_UNUSED_RESULT;
 /* Routines for loading SMF files. */
 smf_t *smf_load(const char *file_name) WARN_UNUSED_RESULT;
 smf_t *smf_load_from_memory(const void *buffer, const int buffer_length) WARN_UNUSED_RESULT;
+smf_t *smf_load_lazy(const char *file_name) WARN_UNUSED_RESULT;
+smf_t *smf_load_from_memory_lazy(const void *buffer, const int buffer_length) WARN_UNUSED_RESULT;
+smf_t *smf_load_parallel(const char *file_name, int number_of_threads) WARN_UNUSED_RESULT;
+smf_t *smf_load_from_memory_parallel(const void *buffer, const int buffer_length, int number_of_threads) WARN_UNUSED_RESULT;
+void smf_load_options_init(smf_load_options_t *options);
+smf_t *smf_load_with_options(const char *file_name, const smf_load_options_t *options) WARN_UNUSED_RESULT;
+smf_t *smf_load_from_memory_with_options(const void *buffer, const int buffer_length,
+	const smf_load_options_t *options) WARN_UNUSED_RESULT;
+
+/**
+ * Called by smf_load_many_with_callback() for every file; "smf" is NULL if the file could not be loaded.
+ * The smf belongs to the callback, which must smf_delete() it before returning to keep memory use bounded.
+ */
+typedef void (*smf_load_many_callback_t)(int file_number, smf_t *smf, void *user_pointer);
+
+/* Routines for loading many SMF files at once. */
+int smf_load_many(const char **file_names, int number_of_files, smf_t **smfs, int number_of_threads) WARN_UNUSED_RESULT;
+int smf_load_many_from_memory(const void **buffers, const int *buffer_lengths, int number_of_files, smf_t **smfs,
+	int number_of_threads) WARN_UNUSED_RESULT;
+int smf_load_many_with_callback(const char **file_names, int number_of_files, smf_load_many_callback_t callback,
+	void *user_pointer, int number_of_threads);
+
+/* Routines for examining SMF files without loading them. */
+smf_probe_t *smf_probe(const char *file_name, int flags) WARN_UNUSED_RESULT;
+smf_probe_t *smf_probe_from_memory(const void *buffer, const int buffer_length, int flags) WARN_UNUSED_RESULT;
+void smf_probe_delete(smf_probe_t *probe);
+
+/* Routines for incremental loading of SMF files. */
+smf_parser_t *smf_parser_new(smf_parser_callback_t callback, void *user_pointer) WARN_UNUSED_RESULT;
+int smf_parser_feed(smf_parser_t *parser, const void *buffer, int buffer_length) WARN_UNUSED_RESULT;
+smf_t *smf_parser_finish(smf_parser_t *parser) WARN_UNUSED_RESULT;
 
 /* Routine for writing SMF files. */
 int smf_save(smf_t *smf, const char *file_name) WARN_UNUSED_RESULT;
@@ -0,0 +1,226 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Arena allocator, used for events created by the loader.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "smf.h"
+#include "smf_private.h"
+
+/** Size of the first block; every next one is twice as large, up to SMF_ARENA_MAX_BLOCK_SIZE. */
+#define SMF_ARENA_MIN_BLOCK_SIZE	(16 * 1024)
+#define SMF_ARENA_MAX_BLOCK_SIZE	(1024 * 1024)
+
+/** Everything allocated from the arena is aligned to this. */
+#define SMF_ARENA_ALIGNMENT		8
+
+/** Single block of memory; allocations are carved from it, one after another. */
+struct smf_arena_block_struct {
+	struct smf_arena_block_struct	*next;
+	struct smf_arena_struct		*arena;
+	size_t				length;
+	size_t				used;
+	/* Memory follows. */
+};
+
+/**
+ * Arena is a set of blocks that are freed all at once.  It is referenced by the track that owns it
+ * and by every event allocated from it, so it stays around as long as any of them does, even if
+ * the event gets removed from the track and the track gets deleted.
+ */
+struct smf_arena_struct {
+	struct smf_arena_block_struct	*blocks;
+	size_t				next_block_length;
+	int				references;
+};
+
+/**
+ * \internal
+ *
+ * Allocates new, empty arena, with one reference.
+ * \return pointer to smf_arena_t or NULL.
+ */
+smf_arena_t *
+smf_arena_new(void)
+{
+	smf_arena_t *arena = malloc(sizeof(smf_arena_t));
+	if (arena == NULL) {
+		g_critical("Cannot allocate smf_arena_t structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(arena, 0, sizeof(smf_arena_t));
+
+	arena->next_block_length = SMF_ARENA_MIN_BLOCK_SIZE;
+	arena->references = 1;
+
+	return (arena);
+}
+
+/**
+ * \internal
+ *
+ * Adds a reference to the arena.
+ */
+void
+smf_arena_ref(smf_arena_t *arena)
+{
+	assert(arena->references > 0);
+
+	arena->references++;
+}
+
+/**
+ * \internal
+ *
+ * Drops a reference to the arena.  Last one frees it, together with everything allocated from it.
+ */
+void
+smf_arena_unref(smf_arena_t *arena)
+{
+	struct smf_arena_block_struct *block;
+
+	assert(arena->references > 0);
+
+	arena->references--;
+	if (arena->references > 0)
+		return;
+
+	while (arena->blocks != NULL) {
+		block = arena->blocks;
+		arena->blocks = block->next;
+
+		free(block);
+	}
+
+	memset(arena, 0, sizeof(smf_arena_t));
+	free(arena);
+}
+
+/**
+ * \internal
+ *
+ * Allocates "length" bytes from the arena.  There is no way to free them, other than
+ * dropping the last reference to the arena.
+ * \return pointer to allocated memory or NULL.
+ */
+void *
+smf_arena_alloc(smf_arena_t *arena, size_t length)
+{
+	void *ptr;
+	size_t block_length;
+	struct smf_arena_block_struct *block = arena->blocks;
+
+	/* Round up, so the next allocation is properly aligned. */
+	length = (length + SMF_ARENA_ALIGNMENT - 1) & ~((size_t)SMF_ARENA_ALIGNMENT - 1);
+
+	if (block == NULL || block->length - block->used < length) {
+		block_length = arena->next_block_length;
+		if (block_length < length)
+			block_length = length;
+
+		block = malloc(sizeof(struct smf_arena_block_struct) + block_length);
+		if (block == NULL) {
+			g_critical("Cannot allocate arena block: %s", strerror(errno));
+			return (NULL);
+		}
+
+		block->arena = arena;
+		block->length = block_length;
+		block->used = 0;
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		if (arena->next_block_length < SMF_ARENA_MAX_BLOCK_SIZE)
+			arena->next_block_length *= 2;
+	}
+
+	ptr = (unsigned char *)(block + 1) + block->used;
+	block->used += length;
+
+	return (ptr);
+}
+
+/**
+ * \internal
+ *
+ * \return Distance, in bytes, from the start of the arena block to "ptr", which must be
+ * the memory returned by the most recent call to smf_arena_alloc().  Always greater than zero.
+ */
+int
+smf_arena_offset(const smf_arena_t *arena, const void *ptr)
+{
+	const unsigned char *start = (const unsigned char *)arena->blocks;
+
+	assert(arena->blocks != NULL);
+	assert((const unsigned char *)ptr > start);
+	assert((const unsigned char *)ptr < start + sizeof(struct smf_arena_block_struct) + arena->blocks->length);
+
+	return ((const unsigned char *)ptr - start);
+}
+
+/**
+ * \internal
+ *
+ * \return Arena that "ptr" was allocated from, given the offset returned by smf_arena_offset().
+ */
+smf_arena_t *
+smf_arena_of(const void *ptr, int offset)
+{
+	const struct smf_arena_block_struct *block;
+
+	assert(offset > 0);
+
+	block = (const struct smf_arena_block_struct *)((const unsigned char *)ptr - offset);
+
+	return (block->arena);
+}
+
+/**
+ * \internal
+ *
+ * \return Number of blocks allocated by the arena so far, that is, number of times it called malloc(3).
+ */
+int
+smf_arena_number_of_blocks(const smf_arena_t *arena)
+{
+	int number_of_blocks = 0;
+	const struct smf_arena_block_struct *block;
+
+	for (block = arena->blocks; block != NULL; block = block->next)
+		number_of_blocks++;
+
+	return (number_of_blocks);
+}
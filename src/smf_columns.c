@@ -0,0 +1,214 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Columnar copies of tracks, for scanning many events at once.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "smf.h"
+#include "smf_private.h"
+
+/**
+ * Makes a columnar copy of the track: instead of an array of pointers to events scattered all over
+ * the memory, times in pulses, times in seconds and status bytes of the events are stored in their
+ * own arrays, and their MIDI messages one after another, in a single block.  Scanning these is much
+ * faster than going through the events, as every cache line holds data of many events and nothing else;
+ * simple loops over them, like the one in smf_columns_select_status(), can be vectorized by the compiler.
+ * Everything is allocated in one block of memory.
+ *
+ * This is a copy; it does not change when the track gets modified afterwards.  Columns made from
+ * a track of frozen smf (see smf_freeze()) stay valid for as long as it does.  Events are in the order
+ * they are in the track, so index "i" in columns is the event number i + 1.
+ *
+ * \return Columns or NULL, if memory allocation failed.
+ */
+smf_columns_t *
+smf_columns_new(smf_track_t *track)
+{
+	int i, number_of_events, payload_length = 0;
+	size_t size;
+	smf_columns_t *columns;
+	smf_event_t *event;
+
+	/* Tracks loaded lazily have no events until parsed. */
+	smf_track_parse_lazy(track);
+	smf_track_renumber_events(track);
+
+	number_of_events = track->events_array->len;
+
+	for (i = 0; i < number_of_events; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+		payload_length += event->midi_buffer_length;
+	}
+
+	/* Doubles go first, right after the structure, so they are aligned. */
+	size = sizeof(smf_columns_t) + number_of_events * (sizeof(double) + sizeof(int) + 1) +
+		(number_of_events + 1) * sizeof(int) + payload_length;
+
+	columns = malloc(size);
+	if (columns == NULL) {
+		g_critical("Cannot allocate smf_columns_t: %s", strerror(errno));
+		return (NULL);
+	}
+
+	columns->number_of_events = number_of_events;
+	columns->time_seconds = (double *)(columns + 1);
+	columns->time_pulses = (int *)(columns->time_seconds + number_of_events);
+	columns->payload_offset = columns->time_pulses + number_of_events;
+	columns->status = (unsigned char *)(columns->payload_offset + number_of_events + 1);
+	columns->payload = columns->status + number_of_events;
+
+	columns->payload_offset[0] = 0;
+
+	for (i = 0; i < number_of_events; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		columns->time_pulses[i] = event->time_pulses;
+		columns->time_seconds[i] = event->time_seconds;
+		columns->status[i] = event->midi_buffer_length > 0 ? event->midi_buffer[0] : 0;
+
+		memcpy(columns->payload + columns->payload_offset[i], event->midi_buffer, event->midi_buffer_length);
+		columns->payload_offset[i + 1] = columns->payload_offset[i] + event->midi_buffer_length;
+	}
+
+	return (columns);
+}
+
+/**
+ * Frees the columns.
+ */
+void
+smf_columns_delete(smf_columns_t *columns)
+{
+	free(columns);
+}
+
+/**
+ * Makes an event out of data in the columns, for use with the routines that expect smf_event_t.
+ * The event is not attached to any track and, just like one returned by smf_event_new(), has its
+ * time fields unset, so it can be passed to smf_track_add_event_pulses() and friends, e.g. with
+ * columns->time_pulses[index] as the time.  It needs to be freed using smf_event_delete(), unless
+ * it gets added to a track.
+ *
+ * \param columns Columns.
+ * \param index Index of the event, from 0 to columns->number_of_events - 1.
+ * \return Event or NULL, if memory allocation failed.
+ */
+smf_event_t *
+smf_columns_get_event(const smf_columns_t *columns, int index)
+{
+	smf_event_t *event;
+
+	assert(index >= 0 && index < columns->number_of_events);
+
+	event = smf_event_new_from_pointer(columns->payload + columns->payload_offset[index],
+		columns->payload_offset[index + 1] - columns->payload_offset[index]);
+
+	return (event);
+}
+
+/**
+ * \return Index of the first event that does not happen before "pulses", or columns->number_of_events
+ * if there is no such event.  Takes time logarithmic in the number of events.
+ */
+int
+smf_columns_find_position_pulses(const smf_columns_t *columns, int pulses)
+{
+	int low = 0, high = columns->number_of_events, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+
+		if (columns->time_pulses[middle] < pulses)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (low);
+}
+
+/**
+ * \return Index of the first event that does not happen before "seconds", or columns->number_of_events
+ * if there is no such event.  Takes time logarithmic in the number of events.
+ */
+int
+smf_columns_find_position_seconds(const smf_columns_t *columns, double seconds)
+{
+	int low = 0, high = columns->number_of_events, middle;
+
+	while (low < high) {
+		middle = low + (high - low) / 2;
+
+		if (columns->time_seconds[middle] < seconds)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return (low);
+}
+
+/**
+ * Finds events whose status byte, ANDed with "mask", equals "value".  For example, mask 0xF0
+ * and value 0x90 selects Note On messages on all channels, and mask 0xFF and value 0xFF selects
+ * metaevents.
+ *
+ * \param columns Columns.
+ * \param mask Bits of the status byte to compare.
+ * \param value Value to compare them with.
+ * \param indexes Array of at least columns->number_of_events elements, to store indexes of the events
+ * found in, in increasing order; may be NULL if you only need to count them.
+ * \return Number of events found.
+ */
+int
+smf_columns_select_status(const smf_columns_t *columns, unsigned char mask, unsigned char value, int *indexes)
+{
+	int i, found = 0;
+
+	if (indexes == NULL) {
+		for (i = 0; i < columns->number_of_events; i++)
+			found += ((columns->status[i] & mask) == value);
+
+		return (found);
+	}
+
+	/* Branch-free: the index gets written either way, but kept only if the event matches. */
+	for (i = 0; i < columns->number_of_events; i++) {
+		indexes[found] = i;
+		found += ((columns->status[i] & mask) == value);
+	}
+
+	return (found);
+}
@@ -0,0 +1,377 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Read cursors, for iterating over the song without modifying it.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "smf.h"
+#include "smf_private.h"
+
+struct smf_cursor_struct {
+	smf_t		*smf;
+
+	/** Number of tracks the arrays below were allocated for. */
+	int		number_of_tracks;
+
+	/** For every track, index in track->events_array of the next event to return. */
+	int		*next_event_index;
+
+	/** Indexes of the tracks that have events left, as a binary heap ordered by time
+	    of the next event and track number; same order as smf_get_next_event() uses. */
+	int		*heap;
+	int		heap_length;
+};
+
+static smf_track_t *
+cursor_track(const smf_cursor_t *cursor, int track_index)
+{
+	return (g_ptr_array_index(cursor->smf->tracks_array, track_index));
+}
+
+/**
+ * \return Next event of the track, or NULL if the cursor is past the end of it.
+ */
+static smf_event_t *
+cursor_track_next_event(const smf_cursor_t *cursor, int track_index)
+{
+	smf_track_t *track = cursor_track(cursor, track_index);
+	int i = cursor->next_event_index[track_index];
+
+	if (i >= track->events_array->len)
+		return (NULL);
+
+	return (g_ptr_array_index(track->events_array, i));
+}
+
+/**
+ * \return Nonzero if the next event of track "a" should be returned before the one of track "b".
+ */
+static int
+track_goes_before(const smf_cursor_t *cursor, int a, int b)
+{
+	int a_pulses = cursor_track_next_event(cursor, a)->time_pulses;
+	int b_pulses = cursor_track_next_event(cursor, b)->time_pulses;
+
+	if (a_pulses != b_pulses)
+		return (a_pulses < b_pulses);
+
+	return (a < b);
+}
+
+static void
+heap_sift_down(smf_cursor_t *cursor, int i)
+{
+	int child, track_index = cursor->heap[i];
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= cursor->heap_length)
+			break;
+
+		if (child + 1 < cursor->heap_length && track_goes_before(cursor, cursor->heap[child + 1], cursor->heap[child]))
+			child++;
+
+		if (!track_goes_before(cursor, cursor->heap[child], track_index))
+			break;
+
+		cursor->heap[i] = cursor->heap[child];
+		i = child;
+	}
+
+	cursor->heap[i] = track_index;
+}
+
+/**
+ * Builds the heap from cursor->next_event_index.
+ * \return Nonzero if there are events left.
+ */
+static int
+build_heap(smf_cursor_t *cursor)
+{
+	int i;
+
+	cursor->heap_length = 0;
+
+	for (i = 0; i < cursor->number_of_tracks; i++) {
+		if (cursor_track_next_event(cursor, i) != NULL)
+			cursor->heap[cursor->heap_length++] = i;
+	}
+
+	for (i = cursor->heap_length / 2 - 1; i >= 0; i--)
+		heap_sift_down(cursor, i);
+
+	return (cursor->heap_length > 0);
+}
+
+/**
+ * Makes sure the arrays are large enough for all the tracks in the smf; tracks might have been
+ * added since the cursor was created.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+static int
+cursor_resize(smf_cursor_t *cursor)
+{
+	int *next_event_index, *heap, number_of_tracks = cursor->smf->number_of_tracks;
+
+	if (number_of_tracks <= cursor->number_of_tracks) {
+		cursor->number_of_tracks = number_of_tracks;
+		return (0);
+	}
+
+	next_event_index = realloc(cursor->next_event_index, number_of_tracks * sizeof(int));
+	if (next_event_index == NULL) {
+		g_critical("Cannot allocate cursor: %s", strerror(errno));
+		return (-1);
+	}
+	cursor->next_event_index = next_event_index;
+
+	heap = realloc(cursor->heap, number_of_tracks * sizeof(int));
+	if (heap == NULL) {
+		g_critical("Cannot allocate cursor: %s", strerror(errno));
+		return (-2);
+	}
+	cursor->heap = heap;
+
+	cursor->number_of_tracks = number_of_tracks;
+
+	return (0);
+}
+
+/**
+ * Allocates new read cursor for the smf, positioned at the start of the song.  Cursor keeps its
+ * position to itself, so there may be any number of cursors for one smf, and using them
+ * does not change the position of smf_get_next_event().  Reading from a cursor never modifies
+ * the smf, its tracks or events, so cursors may be used from different threads at the same time
+ * without locking, as long as nobody modifies the smf meanwhile.
+ *
+ * This function parses tracks loaded using smf_load_lazy() and fixes event numbers after removals;
+ * if there is nothing to do, it does not modify the smf either.  After modifying the smf, call
+ * smf_cursor_rewind() or one of the seek functions before using the cursor again.  Note that cursors
+ * do not update event->event_number and event->track_number of events they return, as described
+ * in smf_event_struct, so if events or tracks get removed, create new cursors, or call smf_rewind() first.
+ *
+ * \return Cursor or NULL, if allocation failed.
+ */
+smf_cursor_t *
+smf_cursor_new(smf_t *smf)
+{
+	int i;
+	smf_cursor_t *cursor;
+
+	cursor = malloc(sizeof(smf_cursor_t));
+	if (cursor == NULL) {
+		g_critical("Cannot allocate smf_cursor_t structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(cursor, 0, sizeof(smf_cursor_t));
+	cursor->smf = smf;
+
+	/* Cursors cannot parse the tracks or renumber events later, as that would modify the smf. */
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		smf_track_renumber_events(smf_get_track_by_number(smf, i));
+
+	if (cursor_resize(cursor)) {
+		smf_cursor_delete(cursor);
+		return (NULL);
+	}
+
+	smf_cursor_rewind(cursor);
+
+	return (cursor);
+}
+
+/**
+ * Frees the cursor.  Does not affect the smf.
+ */
+void
+smf_cursor_delete(smf_cursor_t *cursor)
+{
+	free(cursor->next_event_index);
+	free(cursor->heap);
+
+	memset(cursor, 0, sizeof(smf_cursor_t));
+	free(cursor);
+}
+
+/**
+ * Rewinds the cursor to the start of the song.
+ */
+void
+smf_cursor_rewind(smf_cursor_t *cursor)
+{
+	int i;
+
+	if (cursor_resize(cursor)) {
+		cursor->heap_length = 0;
+		return;
+	}
+
+	for (i = 0; i < cursor->number_of_tracks; i++)
+		cursor->next_event_index[i] = 0;
+
+	build_heap(cursor);
+}
+
+/**
+ * \return Next event, in time order, or NULL, if there are none left.  Does not advance the cursor.
+ */
+smf_event_t *
+smf_cursor_peek_next_event(const smf_cursor_t *cursor)
+{
+	if (cursor->heap_length == 0)
+		return (NULL);
+
+	return (cursor_track_next_event(cursor, cursor->heap[0]));
+}
+
+/**
+ * \return Next event, in time order, or NULL, if there are none left.  Events come in the same order
+ * as from smf_get_next_event().
+ */
+smf_event_t *
+smf_cursor_get_next_event(smf_cursor_t *cursor)
+{
+	int track_index;
+	smf_event_t *event;
+
+	if (cursor->heap_length == 0)
+		return (NULL);
+
+	track_index = cursor->heap[0];
+	event = cursor_track_next_event(cursor, track_index);
+	assert(event != NULL);
+
+	cursor->next_event_index[track_index]++;
+
+	/* No more events in this track? */
+	if (cursor_track_next_event(cursor, track_index) == NULL) {
+		cursor->heap_length--;
+		cursor->heap[0] = cursor->heap[cursor->heap_length];
+	}
+
+	if (cursor->heap_length > 0)
+		heap_sift_down(cursor, 0);
+
+	return (event);
+}
+
+/**
+ * Seeks the cursor to the given event, so that smf_cursor_get_next_event() returns it next.
+ * Works like smf_seek_to_event().
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_cursor_seek_to_event(smf_cursor_t *cursor, const smf_event_t *target)
+{
+	int i, target_track_index;
+	smf_track_t *track;
+
+	assert(target->track != NULL);
+
+	track = smf_track_of_event(cursor->smf, target);
+	assert(track != NULL);
+
+	if (cursor_resize(cursor))
+		return (-1);
+
+	target_track_index = track->track_number - 1;
+
+	/* See smf_seek_to_event(). */
+	for (i = 0; i < cursor->number_of_tracks; i++) {
+		track = cursor_track(cursor, i);
+
+		if (i == target_track_index)
+			cursor->next_event_index[i] = smf_event_index(target);
+		else if (i < target_track_index)
+			cursor->next_event_index[i] = smf_track_find_position_pulses(track, target->time_pulses + 1);
+		else
+			cursor->next_event_index[i] = smf_track_find_position_pulses(track, target->time_pulses);
+	}
+
+	build_heap(cursor);
+
+	return (0);
+}
+
+/**
+ * Seeks the cursor to the given position.  Works like smf_seek_to_seconds().
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_cursor_seek_to_seconds(smf_cursor_t *cursor, double seconds)
+{
+	int i;
+
+	assert(seconds >= 0.0);
+
+	if (cursor_resize(cursor))
+		return (-1);
+
+	for (i = 0; i < cursor->number_of_tracks; i++)
+		cursor->next_event_index[i] = smf_track_find_position_seconds(cursor_track(cursor, i), seconds);
+
+	if (!build_heap(cursor)) {
+		g_critical("Trying to seek past the end of song.");
+		return (-2);
+	}
+
+	return (0);
+}
+
+/**
+ * Seeks the cursor to the given position.  Works like smf_seek_to_pulses().
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_cursor_seek_to_pulses(smf_cursor_t *cursor, int pulses)
+{
+	int i;
+
+	assert(pulses >= 0);
+
+	if (cursor_resize(cursor))
+		return (-1);
+
+	for (i = 0; i < cursor->number_of_tracks; i++)
+		cursor->next_event_index[i] = smf_track_find_position_pulses(cursor_track(cursor, i), pulses);
+
+	if (!build_heap(cursor)) {
+		g_critical("Trying to seek past the end of song.");
+		return (-2);
+	}
+
+	return (0);
+}
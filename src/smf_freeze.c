@@ -0,0 +1,230 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Frozen, read-only copies of smf, for sharing between threads.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include "smf.h"
+#include "smf_private.h"
+
+/**
+ * Makes a frozen copy of the smf: a snapshot that cannot be modified and is therefore safe to read
+ * from any number of threads at once, without locking.  Everything - the smf, tracks, events, their
+ * MIDI data and the tempo map - is stored in a single block of memory, with events of each track
+ * next to each other.  Routines that would modify the snapshot, including smf_get_next_event(),
+ * smf_rewind() and the seek functions, which change the position in song, refuse to work on it;
+ * to iterate over it, use cursors (smf_cursor_new() etc.), one per thread.
+ *
+ * The snapshot does not depend on "smf" in any way; you may modify or delete the original afterwards.
+ * Frozen smf is reference counted; use smf_ref() to add a reference and smf_delete() to drop one.
+ * Freezing a frozen smf just adds a reference to it.  event->user_pointer and track->user_pointer
+ * are copied to the snapshot.
+ *
+ * \return Frozen smf or NULL, if memory allocation failed.
+ */
+smf_t *
+smf_freeze(smf_t *smf)
+{
+	int i, j, number_of_events = 0, data_length = 0;
+	size_t size;
+	smf_t *frozen;
+	smf_track_t *track, *frozen_track;
+	smf_event_t *event, *frozen_event;
+	smf_tempo_t *frozen_tempo;
+	unsigned char *data;
+
+	if (smf->frozen)
+		return (smf_ref(smf));
+
+	/* This also parses any tracks that were loaded lazily. */
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
+
+		number_of_events += track->number_of_events;
+
+		for (j = 0; j < track->events_array->len; j++) {
+			event = g_ptr_array_index(track->events_array, j);
+
+			if (event->midi_buffer_length > SMF_INLINE_BUFFER_LENGTH)
+				data_length += event->midi_buffer_length;
+		}
+	}
+
+	size = sizeof(smf_t) + smf->number_of_tracks * sizeof(smf_track_t) + number_of_events * sizeof(smf_event_t) +
+		smf->tempo_array->len * sizeof(smf_tempo_t) + data_length;
+
+	frozen = malloc(size);
+	if (frozen == NULL) {
+		g_critical("Cannot allocate frozen smf: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(frozen, 0, size);
+
+	frozen_track = (smf_track_t *)(frozen + 1);
+	frozen_event = (smf_event_t *)(frozen_track + smf->number_of_tracks);
+	frozen_tempo = (smf_tempo_t *)(frozen_event + number_of_events);
+	data = (unsigned char *)(frozen_tempo + smf->tempo_array->len);
+
+	frozen->format = smf->format;
+	frozen->ppqn = smf->ppqn;
+	frozen->frames_per_second = smf->frames_per_second;
+	frozen->resolution = smf->resolution;
+	frozen->number_of_tracks = smf->number_of_tracks;
+	frozen->frozen = 1;
+	frozen->reference_count = 1;
+
+	frozen->tracks_array = g_ptr_array_sized_new(smf->number_of_tracks);
+	frozen->tempo_array = g_ptr_array_sized_new(smf->tempo_array->len);
+	frozen->next_event_heap = g_ptr_array_new();
+	frozen->length_heap = g_ptr_array_new();
+
+	for (i = 1; i <= smf->number_of_tracks; i++, frozen_track++) {
+		track = smf_get_track_by_number(smf, i);
+
+		frozen_track->smf = frozen;
+		frozen_track->track_number = i;
+		frozen_track->number_of_events = track->number_of_events;
+		frozen_track->next_event_number = -1;
+		frozen_track->first_removed = -1;
+		frozen_track->length_heap_index = -1;
+		frozen_track->user_pointer = track->user_pointer;
+		frozen_track->events_array = g_ptr_array_sized_new(track->events_array->len);
+
+		for (j = 0; j < track->events_array->len; j++, frozen_event++) {
+			event = g_ptr_array_index(track->events_array, j);
+
+			*frozen_event = *event;
+			frozen_event->track = frozen_track;
+			frozen_event->event_number = j + 1;
+			frozen_event->track_number = i;
+			frozen_event->arena_offset = 0;
+
+			if (event->midi_buffer_length > SMF_INLINE_BUFFER_LENGTH) {
+				frozen_event->midi_buffer = data;
+				data += event->midi_buffer_length;
+			} else {
+				frozen_event->midi_buffer = frozen_event->inline_buffer;
+			}
+
+			memcpy(frozen_event->midi_buffer, event->midi_buffer, event->midi_buffer_length);
+
+			g_ptr_array_add(frozen_track->events_array, frozen_event);
+		}
+
+		g_ptr_array_add(frozen->tracks_array, frozen_track);
+	}
+
+	for (i = 0; i < smf->tempo_array->len; i++, frozen_tempo++) {
+		*frozen_tempo = *(smf_tempo_t *)g_ptr_array_index(smf->tempo_array, i);
+		g_ptr_array_add(frozen->tempo_array, frozen_tempo);
+	}
+
+	/* Nothing may be computed lazily once the snapshot is shared. */
+	smf_build_length_heap(frozen);
+
+	return (frozen);
+}
+
+/**
+ * Adds a reference to the frozen smf.  Each reference needs to be dropped using smf_delete().
+ * Only frozen smfs are reference counted; see smf_freeze().
+ * \return The smf, or NULL if it's not frozen.
+ */
+smf_t *
+smf_ref(smf_t *smf)
+{
+	if (!smf->frozen) {
+		g_critical("smf_ref: only frozen smf can be referenced; see smf_freeze().");
+		return (NULL);
+	}
+
+	g_atomic_int_inc(&(smf->reference_count));
+
+	return (smf);
+}
+
+/**
+ * \return Nonzero if the smf was made by smf_freeze().
+ */
+int
+smf_is_frozen(const smf_t *smf)
+{
+	return (smf->frozen);
+}
+
+/**
+ * \internal
+ *
+ * Drops a reference to the frozen smf and frees it when it was the last one.  Called by smf_delete().
+ */
+void
+smf_frozen_unref(smf_t *smf)
+{
+	int i;
+
+	assert(smf->frozen);
+
+	if (!g_atomic_int_dec_and_test(&(smf->reference_count)))
+		return;
+
+	for (i = 0; i < smf->tracks_array->len; i++)
+		g_ptr_array_free(((smf_track_t *)g_ptr_array_index(smf->tracks_array, i))->events_array, TRUE);
+
+	g_ptr_array_free(smf->tracks_array, TRUE);
+	g_ptr_array_free(smf->tempo_array, TRUE);
+	g_ptr_array_free(smf->next_event_heap, TRUE);
+	g_ptr_array_free(smf->length_heap, TRUE);
+
+	/* Tracks, events and everything else live in the same block. */
+	free(smf);
+}
+
+/**
+ * \internal
+ *
+ * Routines that modify the smf call this first.
+ * \return Nonzero, after complaining, if "smf" is frozen.
+ */
+int
+smf_refuse_if_frozen(const smf_t *smf, const char *function_name)
+{
+	if (smf == NULL || !smf->frozen)
+		return (0);
+
+	g_critical("%s: smf is frozen and cannot be modified; see smf_freeze().", function_name);
+
+	return (1);
+}
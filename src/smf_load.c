@@ -40,6 +40,7 @@
 #include <math.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 #ifdef __MINGW32__
 #include <windows.h>
 #else /* ! __MINGW32__ */
@@ -48,6 +49,14 @@
 #include "smf.h"
 #include "smf_private.h"
 
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H) && defined(HAVE_UNISTD_H)
+#define SMF_USE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 /**
  * Returns pointer to the next SMF chunk in smf->buffer, based on length of the previous one.
  * Returns NULL in case of error.
@@ -206,44 +215,99 @@ parse_mthd_chunk(smf_t *smf)
 }
 
 /**
+ * \internal
+ *
  * Interprets Variable Length Quantity pointed at by "buf" and puts its value into "value" and number
  * of bytes consumed into "len", making sure it does not read past "buf" + "buffer_length".
  * Explanation of Variable Length Quantities is here: http://www.borg.com/~jglatt/tech/midifile/vari.htm
  * Returns 0 iff everything went OK, different value in case of error.
  */
-static int
-extract_vlq(const unsigned char *buf, const int buffer_length, int *value, int *len)
+int
+smf_extract_vlq(const unsigned char *buf, const int buffer_length, int *value, int *len)
 {
-	int val = 0;
-	const unsigned char *c = buf;
+	int i = 0, val = 0;
 
 	assert(buffer_length > 0);
 
-	for (;;) {
-		if (c >= buf + buffer_length) {
-			g_critical("End of buffer in extract_vlq().");
-			return (-1);
+	/* Usual case: VLQ cannot be longer than four bytes, so if there are four, no need to check each one. */
+	if (buffer_length >= 4) {
+		for (; i < 4; i++) {
+			val = (val << 7) + (buf[i] & 0x7F);
+
+			if (!(buf[i] & 0x80)) {
+				*value = val;
+				*len = i + 1;
+
+				return (0);
+			}
 		}
+	}
 
-		val = (val << 7) + (*c & 0x7F);
+	/* Short buffer, or VLQ too long; in the latter case, this finds out whether it ends at all. */
+	for (; i < buffer_length; i++) {
+		val = (val << 7) + (buf[i] & 0x7F);
 
-		if (*c & 0x80)
-			c++;
-		else
-			break;
-	};
+		if (!(buf[i] & 0x80)) {
+			if (i >= 4) {
+				g_critical("SMF error: Variable Length Quantities longer than four bytes are not supported yet.");
+				return (-2);
+			}
 
-	*value = val;
-	*len = c - buf + 1;
+			*value = val;
+			*len = i + 1;
 
-	if (*len > 4) {
-		g_critical("SMF error: Variable Length Quantities longer than four bytes are not supported yet.");
-		return (-2);
+			return (0);
+		}
 	}
 
-	return (0);
+	g_critical("End of buffer in extract_vlq().");
+	return (-1);
 }
 
+/* Special values in status_byte_table[]. */
+#define DATA_BYTE	0	/* MSB is zero, so it is not a status byte at all. */
+#define UNKNOWN_STATUS	-1	/* Undefined status byte, e.g. 0xF4. */
+#define SYSEX_STATUS	-2	/* 0xF0; length follows as VLQ. */
+#define ESCAPE_STATUS	-3	/* 0xF7; length follows as VLQ. */
+#define METAEVENT_STATUS -4	/* 0xFF; type and length follow. */
+
+/**
+ * For every byte, expected length of the midi message (including the status byte) it starts,
+ * or one of the special values above.
+ */
+static const signed char status_byte_table[256] = {
+	/* 0x00 - 0x7F: data bytes. */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	/* 0x80: Note Off. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0x90: Note On. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xA0: AfterTouch. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xB0: Control Change. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/* 0xC0: Program Change. */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	/* 0xD0: Channel Pressure. */
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	/* 0xE0: Pitch Wheel. */
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	/*
+	 * 0xF0: SysEx, MTC Quarter Frame, Song Position Pointer, Song Select, undefined, undefined,
+	 * Tune Request, escape, MIDI Clock, Tick, MIDI Start, MIDI Continue, MIDI Stop, undefined,
+	 * Active Sense, metaevent.
+	 */
+	SYSEX_STATUS, 2, 3, 2, UNKNOWN_STATUS, UNKNOWN_STATUS, 1, ESCAPE_STATUS,
+	1, 1, 1, 1, 1, UNKNOWN_STATUS, 1, METAEVENT_STATUS
+};
+
 /**
  * Returns 1 if the given byte is a valid status byte, 0 otherwise.
  */
@@ -256,23 +320,17 @@ is_status_byte(const unsigned char status)
 static int
 is_sysex_byte(const unsigned char status)
 {
-	if (status == 0xF0)
-		return (1);
-
-	return (0);
+	return (status_byte_table[status] == SYSEX_STATUS);
 }
 
 static int
 is_escape_byte(const unsigned char status)
 {
-	if (status == 0xF7)
-		return (1);
-
-	return (0);
+	return (status_byte_table[status] == ESCAPE_STATUS);
 }
 
 /**
- * Just like expected_message_length(), but only for System Exclusive messages.
+ * Just like smf_expected_message_length(), but only for System Exclusive messages and escaped events.
  * Note that value returned by this thing here is the length of SysEx "on the wire",
  * not the number of bytes that this sysex takes in the file - in SMF format sysex
  * contains VLQ telling how many bytes it takes, "on the wire" format does not have
@@ -283,14 +341,14 @@ expected_sysex_length(const unsigned char status, const unsigned char *second_by
 {
 	int sysex_length, len;
 
-	assert(status == 0xF0);
+	assert(is_sysex_byte(status) || is_escape_byte(status));
 
-	if (buffer_length < 3) {
+	if (buffer_length < 1) {
 		g_critical("SMF error: end of buffer in expected_sysex_length().");
 		return (-1);
 	}
 
-	if (extract_vlq(second_byte, buffer_length, &sysex_length, &len))
+	if (smf_extract_vlq(second_byte, buffer_length, &sysex_length, &len))
 		return (-1);
 
 	if (consumed_bytes != NULL)
@@ -303,95 +361,97 @@ expected_sysex_length(const unsigned char status, const unsigned char *second_by
 static int
 expected_escaped_length(const unsigned char status, const unsigned char *second_byte, const int buffer_length, int *consumed_bytes)
 {
+	int length = expected_sysex_length(status, second_byte, buffer_length, consumed_bytes);
+
+	if (length < 0)
+		return (length);
+
 	/* -1, because we do not want to account for 0x7F status. */
-	return (expected_sysex_length(status, second_byte, buffer_length, consumed_bytes) - 1);
+	return (length - 1);
 }
 
 /**
+ * \internal
+ *
  * Returns expected length of the midi message (including the status byte), in bytes, for the given status byte.
  * The "second_byte" points to the expected second byte of the MIDI message.  "buffer_length" is the buffer
  * length limit, counting from "second_byte".  Returns value < 0 iff there was an error.
  */
-static int
-expected_message_length(unsigned char status, const unsigned char *second_byte, const int buffer_length)
+int
+smf_expected_message_length(unsigned char status, const unsigned char *second_byte, const int buffer_length)
 {
-	/* Make sure this really is a valid status byte. */
-	assert(is_status_byte(status));
-
-	/* We cannot use this routine for sysexes. */
-	assert(!is_sysex_byte(status));
-
-	/* We cannot use this routine for escaped events. */
-	assert(!is_escape_byte(status));
+	int length = status_byte_table[status];
 
 	/* Buffer length may be zero, for e.g. realtime messages. */
 	assert(buffer_length >= 0);
 
-	/* Is this a metamessage? */
-	if (status == 0xFF) {
-		if (buffer_length < 2) {
-			g_critical("SMF error: end of buffer in expected_message_length().");
-			return (-1);
-		}
-
-		/*
-		 * Format of this kind of messages is like this: 0xFF 0xwhatever 0xlength and then "length" bytes.
-		 * Second byte points to this:                        ^^^^^^^^^^
-		 */
-		return (*(second_byte + 1) + 3);
-	}
-
-	if ((status & 0xF0) == 0xF0) {
-		switch (status) {
-			case 0xF2: /* Song Position Pointer. */
-				return (3);
-
-			case 0xF1: /* MTC Quarter Frame. */
-			case 0xF3: /* Song Select. */
-				return (2);
-
-			case 0xF6: /* Tune Request. */
-			case 0xF8: /* MIDI Clock. */
-			case 0xF9: /* Tick. */
-			case 0xFA: /* MIDI Start. */
-			case 0xFB: /* MIDI Continue. */
-			case 0xFC: /* MIDI Stop. */
-			case 0xFE: /* Active Sense. */
-				return (1);
-
-			default:
-				g_critical("SMF error: unknown 0xFx-type status byte '0x%x'.", status);
-				return (-2);
-		}
-	}
+	if (length > 0)
+		return (length);
 
-	/* Filter out the channel. */
-	status &= 0xF0;
+	switch (length) {
+		case METAEVENT_STATUS:
+			if (buffer_length < 2) {
+				g_critical("SMF error: end of buffer in expected_message_length().");
+				return (-1);
+			}
 
-	switch (status) {
-		case 0x80: /* Note Off. */
-		case 0x90: /* Note On. */
-		case 0xA0: /* AfterTouch. */
-		case 0xB0: /* Control Change. */
-		case 0xE0: /* Pitch Wheel. */
-			return (3);	
+			/*
+			 * Format of this kind of messages is like this: 0xFF 0xwhatever 0xlength and then "length" bytes.
+			 * Second byte points to this:                        ^^^^^^^^^^
+			 */
+			return (*(second_byte + 1) + 3);
 
-		case 0xC0: /* Program Change. */
-		case 0xD0: /* Channel Pressure. */
-			return (2);
+		case UNKNOWN_STATUS:
+			g_critical("SMF error: unknown 0xFx-type status byte '0x%x'.", status);
+			return (-2);
 
 		default:
-			g_critical("SMF error: unknown status byte '0x%x'.", status);
+			/* Data byte, or SysEx or escape; these have their own routines. */
+			g_critical("SMF error: cannot determine length of message starting with '0x%x'.", status);
 			return (-3);
 	}
 }
 
+/**
+ * MIDI message located in the file buffer, as found by decode_midi_event().  The message
+ * "on the wire" consists of "status" byte, followed by "data_length" bytes pointed to by "data".
+ * For escaped events, "status" is -1 and the message is just the data.
+ */
+struct midi_message_struct {
+	int			status;
+	const unsigned char	*data;
+	int			data_length;
+};
+
+/**
+ * \return Length of the message, in bytes, as it will be stored in event->midi_buffer.
+ */
+static int
+message_length(const struct midi_message_struct *message)
+{
+	if (message->status < 0)
+		return (message->data_length);
+
+	return (message->data_length + 1);
+}
+
+/**
+ * \return First byte of the message, that is, its status byte.
+ */
+static int
+message_first_byte(const struct midi_message_struct *message)
+{
+	if (message->status < 0)
+		return (message->data[0]);
+
+	return (message->status);
+}
+
 static int
-extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_sysex_event(const unsigned char *buf, const int buffer_length, struct midi_message_struct *message, int *len)
 {
 	int status, message_length, vlq_length;
 	const unsigned char *c = buf;
-	(void) last_status;
 
 	status = *buf;
 
@@ -406,20 +466,14 @@ extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event
 
 	c += vlq_length;
 
-	if (vlq_length + message_length >= buffer_length) {
-		g_critical("End of buffer in extract_sysex_event().");
+	if (vlq_length + message_length > buffer_length) {
+		g_critical("End of buffer in decode_sysex_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_sysex_event(): %s", strerror(errno));
-		return (-4);
-	}
-
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
+	message->status = status;
+	message->data = c;
+	message->data_length = message_length - 1;
 
 	*len = vlq_length + message_length;
 
@@ -427,11 +481,11 @@ extract_sysex_event(const unsigned char *buf, const int buffer_length, smf_event
 }
 
 static int
-extract_escaped_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_escaped_event(const unsigned char *buf, const int buffer_length, struct midi_message_struct *message, int *len)
 {
 	int status, message_length, vlq_length;
 	const unsigned char *c = buf;
-	(void) last_status;
+	smf_event_t tmp;
 
 	status = *buf;
 
@@ -447,41 +501,46 @@ extract_escaped_event(const unsigned char *buf, const int buffer_length, smf_eve
 	c += vlq_length;
 
 	if (vlq_length + message_length >= buffer_length) {
-		g_critical("End of buffer in extract_escaped_event().");
+		g_critical("End of buffer in decode_escaped_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_escaped_event(): %s", strerror(errno));
-		return (-4);
+	if (message_length < 1) {
+		g_critical("Escaped event is empty.");
+		return (-1);
 	}
 
-	memcpy(event->midi_buffer, c, message_length);
+	/* The checks below work on events, so wrap the message into one. */
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.midi_buffer = (unsigned char *)c;
+	tmp.midi_buffer_length = message_length;
 
-	if (smf_event_is_valid(event)) {
+	if (!smf_event_is_valid(&tmp)) {
 		g_critical("Escaped event is invalid.");
 		return (-1);
 	}
 
-	if (smf_event_is_system_realtime(event) || smf_event_is_system_common(event)) {
+	if (!smf_event_is_system_realtime(&tmp) && !smf_event_is_system_common(&tmp)) {
 		g_warning("Escaped event is not System Realtime nor System Common.");
 	}
 
-	*len = vlq_length + message_length;
+	message->status = -1;
+	message->data = c;
+	message->data_length = message_length;
+
+	/* +1 for the 0xF7 status. */
+	*len = 1 + vlq_length + message_length;
 
 	return (0);
 }
 
-
 /**
- * Puts MIDI data extracted from from "buf" into "event" and number of consumed bytes into "len".
- * In case valid status is not found, it uses "last_status" (so called "running status").
- * Returns 0 iff everything went OK, value < 0 in case of error.
+ * Locates MIDI message in "buf", puts its description into "message" and number of consumed bytes into "len".
+ * Nothing gets copied or allocated; "message" points into "buf".  In case valid status is not found,
+ * it uses "last_status" (so called "running status").  Returns 0 iff everything went OK, value < 0 in case of error.
  */
 static int
-extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_t *event, int *len, int last_status)
+decode_midi_event(const unsigned char *buf, const int buffer_length, struct midi_message_struct *message, int *len, int last_status)
 {
 	int status, message_length;
 	const unsigned char *c = buf;
@@ -496,6 +555,12 @@ extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_
 	} else {
 		/* No, we use running status then. */
 		status = last_status;
+
+		/* SysEx and escaped events begin with their status byte; running status does not apply to them. */
+		if (is_sysex_byte(status) || is_escape_byte(status)) {
+			g_critical("SMF error: running status used after SysEx or escaped event.");
+			return (-2);
+		}
 	}
 
 	if (!is_status_byte(status)) {
@@ -504,31 +569,25 @@ extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_
 	}
 
 	if (is_sysex_byte(status))
-		return (extract_sysex_event(buf, buffer_length, event, len, last_status));
+		return (decode_sysex_event(buf, buffer_length, message, len));
 
 	if (is_escape_byte(status))
-		return (extract_escaped_event(buf, buffer_length, event, len, last_status));
+		return (decode_escaped_event(buf, buffer_length, message, len));
 
 	/* At this point, "c" points to first byte following the status byte. */
-	message_length = expected_message_length(status, c, buffer_length - (c - buf));
+	message_length = smf_expected_message_length(status, c, buffer_length - (c - buf));
 
 	if (message_length < 0)
 		return (-3);
 
 	if (message_length - 1 > buffer_length - (c - buf)) {
-		g_critical("End of buffer in extract_midi_event().");
+		g_critical("End of buffer in decode_midi_event().");
 		return (-5);
 	}
 
-	event->midi_buffer_length = message_length;
-	event->midi_buffer = malloc(event->midi_buffer_length);
-	if (event->midi_buffer == NULL) {
-		g_critical("Cannot allocate memory in extract_midi_event(): %s", strerror(errno));
-		return (-4);
-	}
-
-	event->midi_buffer[0] = status;
-	memcpy(event->midi_buffer + 1, c, message_length - 1);
+	message->status = status;
+	message->data = c;
+	message->data_length = message_length - 1;
 
 	*len = c + message_length - 1 - buf;
 
@@ -536,58 +595,126 @@ extract_midi_event(const unsigned char *buf, const int buffer_length, smf_event_
 }
 
 /**
- * Locates, basing on track->next_event_offset, the next event data in track->buffer,
- * interprets it, allocates smf_event_t and fills it properly.  Returns smf_event_t
- * or NULL, if there was an error.  Allocating event means adding it to the track;
- * see smf_event_new().
+ * Allocates smf_event_t and fills it with the MIDI message.  If the track has an arena,
+ * event and its MIDI data are allocated from it.  Short messages are stored inside the event.
+ * Returns NULL in case of error.
  */
 static smf_event_t *
-parse_next_event(smf_track_t *track)
+new_event_from_message(smf_track_t *track, const struct midi_message_struct *message)
 {
-	int time = 0, len, buffer_length;
-	unsigned char *c, *start;
+	smf_event_t *event;
 
-	smf_event_t *event = smf_event_new();
-	if (event == NULL)
-		goto error;
+	if (track->arena != NULL) {
+		event = smf_event_new_from_arena(track->arena, message_length(message));
+		if (event == NULL)
+			return (NULL);
+
+	} else {
+		event = smf_event_new();
+		if (event == NULL)
+			return (NULL);
+
+		if (smf_event_allocate_midi_buffer(event, message_length(message))) {
+			smf_event_delete(event);
 
-	c = start = (unsigned char *)track->file_buffer + track->next_event_offset;
+			return (NULL);
+		}
+	}
 
-	assert(track->file_buffer != NULL);
-	assert(track->file_buffer_length > 0);
-	assert(track->next_event_offset > 0);
+	if (message->status < 0) {
+		memcpy(event->midi_buffer, message->data, message->data_length);
+	} else {
+		event->midi_buffer[0] = message->status;
+		memcpy(event->midi_buffer + 1, message->data, message->data_length);
+	}
 
-	buffer_length = track->file_buffer_length - track->next_event_offset;
-	assert(buffer_length > 0);
+	return (event);
+}
+
+/**
+ * Return 1 if message is end-of-the-track, 0 otherwise.
+ */
+static int
+message_is_end_of_track(const struct midi_message_struct *message)
+{
+	if (message->status == 0xFF && message->data[0] == 0x2F)
+		return (1);
 
-	/* First, extract time offset from previous event. */
-	if (extract_vlq(c, buffer_length, &time, &len))
-		goto error;
+	return (0);
+}
 
-	c += len;
-	buffer_length -= len;
+/**
+ * Return 1 if message is Tempo Change or Time Signature metaevent, 0 otherwise.
+ */
+static int
+message_is_tempo_change_or_time_signature(const struct midi_message_struct *message)
+{
+	if (message->status == 0xFF && (message->data[0] == 0x51 || message->data[0] == 0x58))
+		return (1);
 
-	if (buffer_length <= 0)
-		goto error;
+	return (0);
+}
 
-	/* Now, extract the actual event. */
-	if (extract_midi_event(c, buffer_length, event, &len, track->last_status))
-		goto error;
+/**
+ * Decodes the event at "buf", that is, the delta time followed by MIDI message.  Puts the delta time into "delta",
+ * message into "message" and number of consumed bytes into "len".  Returns 0 iff everything went OK.
+ */
+static int
+decode_event(const unsigned char *buf, const int buffer_length, int *delta, struct midi_message_struct *message,
+	int *len, int last_status)
+{
+	int vlq_length, message_length;
 
-	c += len;
-	buffer_length -= len;
-	track->last_status = event->midi_buffer[0];
-	track->next_event_offset += c - start;
+	if (smf_extract_vlq(buf, buffer_length, delta, &vlq_length))
+		return (-1);
 
-	smf_track_add_event_delta_pulses(track, event, time);
+	if (vlq_length >= buffer_length)
+		return (-2);
 
-	return (event);
+	if (decode_midi_event(buf + vlq_length, buffer_length - vlq_length, message, &message_length, last_status))
+		return (-3);
+
+	*len = vlq_length + message_length;
+
+	return (0);
+}
+
+typedef int (*message_callback_t)(int pulses, const struct midi_message_struct *message, void *user_pointer);
+
+/**
+ * Walks through the events in MTrk chunk pointed to by "mtrk", "mtrk_length" bytes long, including
+ * the chunk header, calling "callback" for every one of them, with absolute time of the event, in pulses.
+ * Does not allocate anything.  Stops after End Of Track.  Returns 0 iff the track was walked
+ * up to the End Of Track; otherwise, the track is malformed or callback returned nonzero.
+ */
+static int
+walk_mtrk_chunk(const void *mtrk, const int mtrk_length, message_callback_t callback, void *user_pointer)
+{
+	int pulses = 0, delta, len, last_status = 0;
+	const unsigned char *c, *end;
+	struct midi_message_struct message;
+
+	c = (const unsigned char *)mtrk + sizeof(struct chunk_header_struct);
+	end = (const unsigned char *)mtrk + mtrk_length;
+
+	while (c < end) {
+		if (decode_event(c, end - c, &delta, &message, &len, last_status))
+			return (-1);
+
+		c += len;
+		pulses += delta;
+		last_status = message_first_byte(&message);
 
-error:
-	if (event != NULL)
-		smf_event_delete(event);
+		if (callback(pulses, &message, user_pointer))
+			return (-4);
 
-	return (NULL);
+		if (message_is_end_of_track(&message))
+			return (0);
+	}
+
+	g_critical("SMF error: MTrk chunk ends without End Of Track.");
+
+	return (-5);
 }
 
 /**
@@ -658,7 +785,7 @@ smf_event_extract_text(const smf_event_t *event)
 		return (NULL);
 	}
 
-	extract_vlq((void *)&(event->midi_buffer[2]), event->midi_buffer_length - 2, &string_length, &length_length);
+	smf_extract_vlq((void *)&(event->midi_buffer[2]), event->midi_buffer_length - 2, &string_length, &length_length);
 
 	if (string_length <= 0) {
 		g_critical("smf_event_extract_text: truncated MIDI message.");
@@ -676,6 +803,7 @@ static int
 parse_mtrk_header(smf_track_t *track)
 {
 	struct chunk_header_struct *mtrk;
+	int available;
 
 	/* Make sure compiler didn't do anything stupid. */
 	assert(sizeof(struct chunk_header_struct) == 8);
@@ -695,19 +823,11 @@ parse_mtrk_header(smf_track_t *track)
 
 	track->file_buffer = mtrk;
 	track->file_buffer_length = sizeof(struct chunk_header_struct) + ntohl(mtrk->length);
-	track->next_event_offset = sizeof(struct chunk_header_struct);
-
-	return (0);
-}
 
-/**
- * Return 1 if event is end-of-the-track, 0 otherwise.
- */
-static int
-event_is_end_of_track(const smf_event_t *event)
-{
-	if (event->midi_buffer[0] == 0xFF && event->midi_buffer[1] == 0x2F)
-		return (1);
+	/* Truncated file? */
+	available = (unsigned char *)track->smf->file_buffer + track->smf->file_buffer_length - (unsigned char *)mtrk;
+	if (track->file_buffer_length > available)
+		track->file_buffer_length = available;
 
 	return (0);
 }
@@ -729,7 +849,7 @@ smf_event_length_is_valid(const smf_event_t *event)
 	if (smf_event_is_sysex(event))
 		return (1);
 
-	if (event->midi_buffer_length != expected_message_length(event->midi_buffer[0],
+	if (event->midi_buffer_length != smf_expected_message_length(event->midi_buffer[0],
 		&(event->midi_buffer[1]), event->midi_buffer_length - 1)) {
 
 		return (0);
@@ -762,45 +882,236 @@ smf_event_is_valid(const smf_event_t *event)
 	return (1);
 }
 
+/** Used by append_message_to_track(). */
+struct append_state_struct {
+	smf_track_t			*track;
+	const smf_load_options_t	*options;
+	int				track_selected;
+	int				last_pulses;
+};
+
+/**
+ * Returns 1, iff the track "track_number" is selected by options->track_mask.
+ */
+static int
+track_is_selected(const smf_load_options_t *options, int track_number)
+{
+	if (options == NULL)
+		return (1);
+
+	if (track_number > 64)
+		track_number = 64;
+
+	return ((options->track_mask >> (track_number - 1)) & 1);
+}
+
 /**
- * Parse events and put it on the track.
+ * Returns 1, iff the message should be loaded, according to "options".
  */
 static int
-parse_mtrk_chunk(smf_track_t *track)
+message_is_wanted(const struct midi_message_struct *message, const smf_load_options_t *options, int track_selected)
+{
+	int status = message->status;
+
+	if (options == NULL)
+		return (1);
+
+	/* These are needed for the tempo map and for the track to be valid. */
+	if (message_is_tempo_change_or_time_signature(message) || message_is_end_of_track(message))
+		return (1);
+
+	if (!track_selected)
+		return (0);
+
+	/* Escaped events carry System Common or System Realtime messages. */
+	if (status < 0)
+		return (!(options->skip_events & SMF_LOAD_SKIP_SYSTEM));
+
+	if (status == 0xFF)
+		return (!(options->skip_events & SMF_LOAD_SKIP_METADATA));
+
+	if (is_sysex_byte(status))
+		return (!(options->skip_events & SMF_LOAD_SKIP_SYSEX));
+
+	if (status >= 0xF0)
+		return (!(options->skip_events & SMF_LOAD_SKIP_SYSTEM));
+
+	if (!(options->channel_mask & (1 << (status & 0x0F))))
+		return (0);
+
+	if ((status & 0xF0) == 0xB0)
+		return (!(options->skip_events & SMF_LOAD_SKIP_CONTROLLERS));
+
+	return (1);
+}
+
+static int
+append_message_to_track(int pulses, const struct midi_message_struct *message, void *user_pointer)
 {
+	struct append_state_struct *state = user_pointer;
 	smf_event_t *event;
 
-	if (parse_mtrk_header(track))
+	/* Skipped events don't need anything else; delta times are computed from absolute times. */
+	state->last_pulses = pulses;
+
+	if (!message_is_wanted(message, state->options, state->track_selected))
+		return (0);
+
+	event = new_event_from_message(state->track, message);
+	if (event == NULL)
+		return (-1);
+
+	/* Time in seconds gets computed once the whole track is loaded; see smf_track_compute_seconds(). */
+	event->time_pulses = pulses;
+	event->time_seconds = 0.0;
+	smf_track_append_event(state->track, event);
+
+	assert(smf_event_is_valid(event));
+
+	return (0);
+}
+
+/**
+ * Parse events from track->file_buffer and put them on the track, skipping the ones "options"
+ * (which may be NULL) tell to skip.  Events are just appended, without updating the tempo map
+ * and without computing event->time_seconds; see smf_track_append_event().  Caller is responsible
+ * for doing that afterwards, e.g. using smf_create_tempo_map_and_compute_seconds().
+ */
+static int
+parse_mtrk_events(smf_track_t *track, const smf_load_options_t *options)
+{
+	static const unsigned char eot_data[] = {0x2F, 0x00};
+	struct midi_message_struct eot;
+	struct append_state_struct state;
+
+	state.track = track;
+	state.options = options;
+	state.track_selected = track_is_selected(options, track->track_number);
+	state.last_pulses = 0;
+
+	/* Allocate events in bulk; if that fails, they will be allocated one by one. */
+	if (track->arena == NULL)
+		track->arena = smf_arena_new();
+
+	if (walk_mtrk_chunk(track->file_buffer, track->file_buffer_length, append_message_to_track, &state)) {
+		g_critical("Unable to parse MIDI event; truncating track.");
+
+		eot.status = 0xFF;
+		eot.data = eot_data;
+		eot.data_length = sizeof(eot_data);
+
+		if (append_message_to_track(state.last_pulses, &eot, &state)) {
+			g_critical("Cannot add End Of Track to truncated track.");
+			return (-2);
+		}
+	}
+
+	track->file_buffer = NULL;
+	track->file_buffer_length = 0;
+
+	return (0);
+}
+
+/**
+ * \internal
+ *
+ * Parses track loaded using smf_load_lazy(), if it was not parsed yet.  Tempo map is already complete
+ * at this point, so events are simply appended.  Afterwards, the track is rewound.
+ */
+void
+smf_track_parse_lazy(smf_track_t *track)
+{
+	smf_t *smf = track->smf;
+
+	if (track->lazy_mtrk == NULL)
+		return;
+
+	assert(smf != NULL);
+	assert(track->number_of_events == 0);
+
+	track->file_buffer = track->lazy_mtrk;
+	track->file_buffer_length = track->lazy_mtrk_length;
+	track->lazy_mtrk = NULL;
+	track->lazy_mtrk_length = 0;
+
+	if (parse_mtrk_events(track, NULL))
+		g_critical("SMF warning: Cannot load track.");
+
+	smf_track_compute_seconds(track);
+
+	if (track->number_of_events > 0)
+		track->time_of_next_event = smf_track_get_event_by_number(track, 1)->time_pulses;
+
+	assert(smf->number_of_lazy_tracks > 0);
+	smf->number_of_lazy_tracks--;
+
+	/* Last unparsed track?  We don't need the file anymore. */
+	if (smf->number_of_lazy_tracks == 0)
+		smf_release_lazy_buffer(smf);
+}
+
+/**
+ * Read the whole stream into a buffer that grows as needed.  This is used for streams
+ * that cannot seek, such as pipes, where the length is not known in advance.
+ */
+static int
+read_stream_into_buffer(void **file_buffer, int *file_buffer_length, FILE *stream)
+{
+	int allocated = 65536, used = 0;
+	size_t got;
+	unsigned char *buffer, *tmp;
+
+	buffer = malloc(allocated);
+	if (buffer == NULL) {
+		g_critical("malloc(3) failed: %s", strerror(errno));
+
 		return (-1);
+	}
 
 	for (;;) {
-		event = parse_next_event(track);
+		if (used == allocated) {
+			if (allocated > INT_MAX / 2) {
+				g_critical("Input stream is too large.");
+				free(buffer);
 
-		/* Couldn't parse an event? */
-		if (event == NULL) {
-			g_critical("Unable to parse MIDI event; truncating track.");
-			if (smf_track_add_eot_delta_pulses(track, 0) != 0) {
-				g_critical("smf_track_add_eot_delta_pulses failed.");
 				return (-2);
 			}
-			break;
+
+			allocated *= 2;
+			tmp = realloc(buffer, allocated);
+			if (tmp == NULL) {
+				g_critical("realloc(3) failed: %s", strerror(errno));
+				free(buffer);
+
+				return (-3);
+			}
+
+			buffer = tmp;
 		}
 
-		assert(smf_event_is_valid(event));
+		got = fread(buffer + used, 1, allocated - used, stream);
+		used += got;
 
-		if (event_is_end_of_track(event))
+		if (got == 0)
 			break;
 	}
 
-	track->file_buffer = NULL;
-	track->file_buffer_length = 0;
-	track->next_event_offset = -1;
+	if (ferror(stream)) {
+		g_critical("fread(3) failed: %s", strerror(errno));
+		free(buffer);
+
+		return (-4);
+	}
+
+	*file_buffer = buffer;
+	*file_buffer_length = used;
 
 	return (0);
 }
 
 /**
  * Allocate buffer of proper size and read file contents into it.  Close file afterwards.
+ * If the file cannot seek, it gets read until EOF instead.
  */
 static int
 load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *file_name)
@@ -814,20 +1125,33 @@ load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *f
 	}
 
 	if (fseek(stream, 0, SEEK_END)) {
-		g_critical("fseek(3) failed: %s", strerror(errno));
+		if (read_stream_into_buffer(file_buffer, file_buffer_length, stream)) {
+			fclose(stream);
 
-		return (-2);
+			return (-2);
+		}
+
+		if (fclose(stream)) {
+			g_critical("fclose(3) failed: %s", strerror(errno));
+			free(*file_buffer);
+
+			return (-7);
+		}
+
+		return (0);
 	}
 
 	*file_buffer_length = ftell(stream);
 	if (*file_buffer_length == -1) {
 		g_critical("ftell(3) failed: %s", strerror(errno));
+		fclose(stream);
 
 		return (-3);
 	}
 
 	if (fseek(stream, 0, SEEK_SET)) {
 		g_critical("fseek(3) failed: %s", strerror(errno));
+		fclose(stream);
 
 		return (-4);
 	}
@@ -835,18 +1159,22 @@ load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *f
 	*file_buffer = malloc(*file_buffer_length);
 	if (*file_buffer == NULL) {
 		g_critical("malloc(3) failed: %s", strerror(errno));
+		fclose(stream);
 
 		return (-5);
 	}
 
 	if (fread(*file_buffer, 1, *file_buffer_length, stream) != *file_buffer_length) {
 		g_critical("fread(3) failed: %s", strerror(errno));
+		free(*file_buffer);
+		fclose(stream);
 
 		return (-6);
 	}
 	
 	if (fclose(stream)) {
 		g_critical("fclose(3) failed: %s", strerror(errno));
+		free(*file_buffer);
 
 		return (-7);
 	}
@@ -854,42 +1182,416 @@ load_file_into_buffer(void **file_buffer, int *file_buffer_length, const char *f
 	return (0);
 }
 
+#ifdef SMF_USE_MMAP
+
 /**
-  * Creates new SMF and fills it with data loaded from the given buffer.
- * \return SMF or NULL, if loading failed.
-  */
-smf_t *
-smf_load_from_memory(const void *buffer, const int buffer_length)
+ * Map the file into memory, read-only, so that it can be parsed without copying it first.
+ * Returns 0 iff it worked.  Does not complain on failure - the caller is supposed to fall back
+ * to load_file_into_buffer(), which will report the actual problem, if any.  Files that are
+ * not regular files (pipes, character devices and the like) are never mapped.
+ */
+static int
+map_file_into_memory(void **file_buffer, int *file_buffer_length, const char *file_name)
 {
-	int i;
-
-	smf_t *smf = smf_new();
+	int fd;
+	struct stat st;
+	void *mapping;
 
-	smf->file_buffer = (void *)buffer;
-	smf->file_buffer_length = buffer_length;
-	smf->next_chunk_offset = 0;
+	fd = open(file_name, O_RDONLY);
+	if (fd == -1)
+		return (-1);
 
-	if (parse_mthd_chunk(smf))
-		return (NULL);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > INT_MAX) {
+		close(fd);
+
+		return (-2);
+	}
+
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (mapping == MAP_FAILED)
+		return (-3);
+
+#ifdef MADV_SEQUENTIAL
+	/* We read the file once, from the beginning to the end. */
+	(void) madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	*file_buffer = mapping;
+	*file_buffer_length = st.st_size;
+
+	return (0);
+}
+
+#endif /* SMF_USE_MMAP */
+
+/**
+ * Get contents of the file, either by mapping it into memory or, if that is not possible,
+ * by reading it into allocated buffer.  "mapped" is set to 1 in the former case, so that
+ * free_file_buffer() knows what to do.
+ */
+static int
+get_file_buffer(void **file_buffer, int *file_buffer_length, int *mapped, const char *file_name)
+{
+#ifdef SMF_USE_MMAP
+	if (map_file_into_memory(file_buffer, file_buffer_length, file_name) == 0) {
+		*mapped = 1;
+
+		return (0);
+	}
+#endif
+
+	*mapped = 0;
+
+	return (load_file_into_buffer(file_buffer, file_buffer_length, file_name));
+}
+
+/**
+ * Release buffer obtained using get_file_buffer().
+ */
+static void
+free_file_buffer(void *file_buffer, int file_buffer_length, int mapped)
+{
+#ifdef SMF_USE_MMAP
+	if (mapped) {
+		if (munmap(file_buffer, file_buffer_length))
+			g_critical("munmap(2) failed: %s", strerror(errno));
+
+		return;
+	}
+#else
+	assert(!mapped);
+#endif
+
+	memset(file_buffer, 0, file_buffer_length);
+	free(file_buffer);
+}
+
+/**
+  * Creates new SMF and fills it with data loaded from the given buffer.
+ * \return SMF or NULL, if loading failed.
+  */
+smf_t *
+smf_load_from_memory(const void *buffer, const int buffer_length)
+{
+	return (smf_load_from_memory_with_options(buffer, buffer_length, NULL));
+}
+
+/** Tempo Change or Time Signature found by collect_tempo_message(). */
+struct lazy_tempo_struct {
+	int		time_pulses;
+	int		track_number;
+	int		sequence_number;
+	int		midi_buffer_length;
+	unsigned char	midi_buffer[8];
+};
+
+/** Used by collect_tempo_message(). */
+struct lazy_tempo_array_struct {
+	struct lazy_tempo_struct	*tempos;
+	int				number_of_tempos;
+	int				allocated;
+	int				track_number;
+	int				error;
+};
+
+static int
+collect_tempo_message(int pulses, const struct midi_message_struct *message, void *user_pointer)
+{
+	struct lazy_tempo_array_struct *array = user_pointer;
+	struct lazy_tempo_struct *tempo, *tmp;
+
+	if (!message_is_tempo_change_or_time_signature(message))
+		return (0);
+
+	if (array->number_of_tempos == array->allocated) {
+		array->allocated = array->allocated ? array->allocated * 2 : 16;
+		tmp = realloc(array->tempos, array->allocated * sizeof(struct lazy_tempo_struct));
+		if (tmp == NULL) {
+			g_critical("Cannot allocate memory in collect_tempo_message(): %s", strerror(errno));
+			array->error = 1;
+			return (-1);
+		}
+
+		array->tempos = tmp;
+	}
+
+	tempo = &(array->tempos[array->number_of_tempos]);
+	memset(tempo, 0, sizeof(struct lazy_tempo_struct));
+
+	tempo->time_pulses = pulses;
+	tempo->track_number = array->track_number;
+	tempo->sequence_number = array->number_of_tempos;
+	tempo->midi_buffer_length = MIN(message_length(message), (int)sizeof(tempo->midi_buffer));
+	tempo->midi_buffer[0] = message->status;
+	memcpy(tempo->midi_buffer + 1, message->data, tempo->midi_buffer_length - 1);
+
+	array->number_of_tempos++;
+
+	return (0);
+}
+
+/**
+ * Orders tempos the same way smf_get_next_event() would order events containing them.
+ */
+static int
+lazy_tempo_compare_function(const void *aa, const void *bb)
+{
+	const struct lazy_tempo_struct *a = aa, *b = bb;
+
+	if (a->time_pulses != b->time_pulses)
+		return (a->time_pulses < b->time_pulses ? -1 : 1);
+
+	if (a->track_number != b->track_number)
+		return (a->track_number < b->track_number ? -1 : 1);
+
+	return (a->sequence_number < b->sequence_number ? -1 : 1);
+}
+
+/**
+ * Builds tempo map for SMF whose tracks were not parsed yet, by scanning them for tempo related
+ * metaevents.  Returns 0 iff everything went OK.
+ */
+static int
+create_lazy_tempo_map(smf_t *smf)
+{
+	int i;
+	smf_track_t *track;
+	struct lazy_tempo_array_struct array;
+
+	memset(&array, 0, sizeof(array));
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+		array.track_number = track->track_number;
+
+		/* Malformed tracks get truncated by smf_track_parse_lazy(), so that is not an error. */
+		(void) walk_mtrk_chunk(track->lazy_mtrk, track->lazy_mtrk_length, collect_tempo_message, &array);
+
+		if (array.error) {
+			free(array.tempos);
+			return (-1);
+		}
+	}
+
+	qsort(array.tempos, array.number_of_tempos, sizeof(struct lazy_tempo_struct), lazy_tempo_compare_function);
+
+	for (i = 0; i < array.number_of_tempos; i++) {
+		maybe_add_message_to_tempo_map(smf, array.tempos[i].time_pulses,
+			array.tempos[i].midi_buffer, array.tempos[i].midi_buffer_length);
+	}
+
+	free(array.tempos);
+
+	return (0);
+}
+
+/**
+  * Creates new SMF from the given buffer, without parsing the tracks; every track gets parsed
+  * when it is used for the first time.  The buffer must remain valid until smf_delete() is called,
+  * or until all the tracks are parsed.  See smf_load_lazy().
+  * \return SMF or NULL, if loading failed.
+  */
+smf_t *
+smf_load_from_memory_lazy(const void *buffer, const int buffer_length)
+{
+	int i;
+
+	smf_t *smf = smf_new();
+
+	smf->file_buffer = (void *)buffer;
+	smf->file_buffer_length = buffer_length;
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf_delete(smf);
+		return (NULL);
+	}
 
 	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
 		smf_track_t *track = smf_track_new();
-		if (track == NULL)
+		if (track == NULL) {
+			smf_delete(smf);
 			return (NULL);
+		}
 
 		smf_add_track(smf, track);
 
 		/* Skip unparseable chunks. */
-		if (parse_mtrk_chunk(track)) {
+		if (parse_mtrk_header(track)) {
 			g_warning("SMF warning: Cannot load track.");
 			smf_track_delete(track);
+			continue;
 		}
 
+		track->lazy_mtrk = track->file_buffer;
+		track->lazy_mtrk_length = track->file_buffer_length;
 		track->file_buffer = NULL;
 		track->file_buffer_length = 0;
-		track->next_event_offset = -1;
+
+		smf->number_of_lazy_tracks++;
+	}
+
+	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
+		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
+				smf->expected_number_of_tracks, smf->number_of_tracks);
+
+		smf->expected_number_of_tracks = smf->number_of_tracks;
+	}
+
+	smf->file_buffer = NULL;
+	smf->file_buffer_length = 0;
+	smf->next_chunk_offset = -1;
+
+	if (create_lazy_tempo_map(smf)) {
+		smf_delete(smf);
+		return (NULL);
+	}
+
+	return (smf);
+}
+
+/** Used by smf_load_from_memory_with_options(). */
+struct parse_job_struct {
+	smf_track_t			*track;
+	const smf_load_options_t	*options;
+	int				error;
+};
+
+static void
+parse_job(gpointer data, gpointer user_data)
+{
+	struct parse_job_struct *job = data;
+	(void) user_data;
+
+	/*
+	 * Every track has its own running status and delta times, so it can be parsed independently
+	 * of others.  Tempo map is not touched here; it gets computed after all the tracks are done.
+	 */
+	job->error = parse_mtrk_events(job->track, job->options);
+}
+
+/**
+ * Initializes "options" with defaults, that is, load everything using one thread.
+ */
+void
+smf_load_options_init(smf_load_options_t *options)
+{
+	memset(options, 0, sizeof(smf_load_options_t));
+
+	options->track_mask = G_MAXUINT64;
+	options->channel_mask = 0xFFFF;
+	options->skip_events = 0;
+	options->number_of_threads = 1;
+}
+
+/**
+  * Creates new SMF and fills it with data loaded from the given buffer, parsing tracks
+  * using "number_of_threads" threads, or as many as there are processors, if it's less than one.
+  * Results are the same as with smf_load_from_memory().
+ * \return SMF or NULL, if loading failed.
+  */
+smf_t *
+smf_load_from_memory_parallel(const void *buffer, const int buffer_length, int number_of_threads)
+{
+	smf_load_options_t options;
+
+	smf_load_options_init(&options);
+	options.number_of_threads = number_of_threads;
+
+	return (smf_load_from_memory_with_options(buffer, buffer_length, &options));
+}
+
+/**
+ * Creates new SMF and fills it with data loaded from the given buffer, skipping events as specified
+ * by "options".  Skipped events are not allocated at all.  See smf_load_with_options().
+ *
+ * \param buffer Pointer to the SMF data.
+ * \param buffer_length Length of the data, in bytes.
+ * \param options Options, or NULL to load everything, like smf_load_from_memory() does.
+ * \return SMF or NULL, if loading failed.
+ */
+smf_t *
+smf_load_from_memory_with_options(const void *buffer, const int buffer_length, const smf_load_options_t *options)
+{
+	int i, number_of_threads = 1;
+	GThreadPool *pool = NULL;
+	struct parse_job_struct *jobs;
+	smf_track_t *track;
+
+	smf_t *smf = smf_new();
+
+	smf->file_buffer = (void *)buffer;
+	smf->file_buffer_length = buffer_length;
+	smf->next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(smf)) {
+		smf_delete(smf);
+		return (NULL);
 	}
 
+	/* Locate all the chunks first. */
+	for (i = 1; i <= smf->expected_number_of_tracks; i++) {
+		track = smf_track_new();
+		if (track == NULL) {
+			smf_delete(smf);
+			return (NULL);
+		}
+
+		smf_add_track(smf, track);
+
+		/* Skip unparseable chunks. */
+		if (parse_mtrk_header(track)) {
+			g_warning("SMF warning: Cannot load track.");
+			smf_track_delete(track);
+		}
+	}
+
+	jobs = calloc(smf->number_of_tracks, sizeof(struct parse_job_struct));
+	if (jobs == NULL) {
+		g_critical("Cannot allocate memory in smf_load_from_memory_with_options(): %s", strerror(errno));
+		smf_delete(smf);
+		return (NULL);
+	}
+
+	if (options != NULL)
+		number_of_threads = options->number_of_threads;
+
+	if (number_of_threads < 1)
+		number_of_threads = g_get_num_processors();
+
+	if (number_of_threads > smf->number_of_tracks)
+		number_of_threads = smf->number_of_tracks;
+
+	if (number_of_threads > 1) {
+		pool = g_thread_pool_new(parse_job, NULL, number_of_threads, TRUE, NULL);
+		if (pool == NULL)
+			g_warning("Cannot create thread pool; parsing tracks sequentially.");
+	}
+
+	for (i = 0; i < smf->number_of_tracks; i++) {
+		jobs[i].track = g_ptr_array_index(smf->tracks_array, i);
+		jobs[i].options = options;
+
+		if (pool == NULL || !g_thread_pool_push(pool, &(jobs[i]), NULL))
+			parse_job(&(jobs[i]), NULL);
+	}
+
+	/* Wait for the workers to finish. */
+	if (pool != NULL)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	/* Remove tracks that failed, from last to first, so that the numbers in "jobs" stay valid. */
+	for (i = smf->number_of_tracks - 1; i >= 0; i--) {
+		if (jobs[i].error) {
+			g_warning("SMF warning: Cannot load track.");
+			smf_track_delete(jobs[i].track);
+		}
+	}
+
+	free(jobs);
+
 	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
 		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
 				smf->expected_number_of_tracks, smf->number_of_tracks);
@@ -901,11 +1603,45 @@ smf_load_from_memory(const void *buffer, const int buffer_length)
 	smf->file_buffer_length = 0;
 	smf->next_chunk_offset = -1;
 
+	smf_create_tempo_map_and_compute_seconds(smf);
+
 	return (smf);
 }
 
 /**
- * Loads SMF file.
+ * \internal
+ *
+ * Frees the buffer lazily loaded SMF was loaded from, if it belongs to the SMF.
+ * Called once there are no unparsed tracks left, or from smf_delete().
+ */
+void
+smf_release_lazy_buffer(smf_t *smf)
+{
+	int i;
+	smf_track_t *track;
+
+	for (i = 0; i < smf->tracks_array->len; i++) {
+		track = g_ptr_array_index(smf->tracks_array, i);
+		track->lazy_mtrk = NULL;
+		track->lazy_mtrk_length = 0;
+	}
+
+	smf->number_of_lazy_tracks = 0;
+
+	if (smf->lazy_buffer == NULL)
+		return;
+
+	free_file_buffer(smf->lazy_buffer, smf->lazy_buffer_length, smf->lazy_buffer_mapped);
+
+	smf->lazy_buffer = NULL;
+	smf->lazy_buffer_length = 0;
+	smf->lazy_buffer_mapped = 0;
+}
+
+/**
+ * Loads SMF file.  Where the platform supports it, regular files are mapped into memory
+ * and parsed in place, without copying them into temporary buffer first.  Other files,
+ * e.g. pipes, are read until EOF.
  *
  * \param file_name Path to the file.
  * \return SMF or NULL, if loading failed.
@@ -913,17 +1649,43 @@ smf_load_from_memory(const void *buffer, const int buffer_length)
 smf_t *
 smf_load(const char *file_name)
 {
-	int file_buffer_length;
+	return (smf_load_with_options(file_name, NULL));
+}
+
+/**
+ * Loads SMF file, loading only the events selected by "options"; the rest are skipped without allocating
+ * anything.  Initialize the options using smf_load_options_init() and then change what you need, e.g.:
+ *
+ * \code
+ * smf_load_options_t options;
+ *
+ * smf_load_options_init(&options);
+ * options.channel_mask = 1 << 9;
+ * options.skip_events = SMF_LOAD_SKIP_SYSEX | SMF_LOAD_SKIP_METADATA;
+ *
+ * smf = smf_load_with_options(file_name, &options);
+ * \endcode
+ *
+ * Tempo Change, Time Signature and End Of Track metaevents are always loaded, so that times
+ * of the events are correct.
+ *
+ * \param file_name Path to the file.
+ * \param options Options, or NULL to load everything, like smf_load() does.
+ * \return SMF or NULL, if loading failed.
+ */
+smf_t *
+smf_load_with_options(const char *file_name, const smf_load_options_t *options)
+{
+	int file_buffer_length, mapped;
 	void *file_buffer;
 	smf_t *smf;
 
-	if (load_file_into_buffer(&file_buffer, &file_buffer_length, file_name))
+	if (get_file_buffer(&file_buffer, &file_buffer_length, &mapped, file_name))
 		return (NULL);
 
-	smf = smf_load_from_memory(file_buffer, file_buffer_length);
+	smf = smf_load_from_memory_with_options(file_buffer, file_buffer_length, options);
 
-	memset(file_buffer, 0, file_buffer_length);
-	free(file_buffer);
+	free_file_buffer(file_buffer, file_buffer_length, mapped);
 
 	if (smf == NULL)
 		return (NULL);
@@ -933,3 +1695,897 @@ smf_load(const char *file_name)
 	return (smf);
 }
 
+
+/**
+ * Loads SMF file, without parsing the tracks.  Every track gets parsed when it is used for the first
+ * time, e.g. by smf_get_track_by_number(); until then, the file stays mapped (or loaded) in memory.
+ * Tempo map is computed upfront, so event->time_seconds is correct for events in parsed tracks.
+ * Use it when you need only some of the tracks, or only the MThd information.
+ *
+ * \param file_name Path to the file.
+ * \return SMF or NULL, if loading failed.
+ */
+smf_t *
+smf_load_lazy(const char *file_name)
+{
+	int file_buffer_length, mapped;
+	void *file_buffer;
+	smf_t *smf;
+
+	if (get_file_buffer(&file_buffer, &file_buffer_length, &mapped, file_name))
+		return (NULL);
+
+	smf = smf_load_from_memory_lazy(file_buffer, file_buffer_length);
+	if (smf == NULL) {
+		free_file_buffer(file_buffer, file_buffer_length, mapped);
+		return (NULL);
+	}
+
+	if (smf->number_of_lazy_tracks == 0) {
+		free_file_buffer(file_buffer, file_buffer_length, mapped);
+		return (smf);
+	}
+
+	smf->lazy_buffer = file_buffer;
+	smf->lazy_buffer_length = file_buffer_length;
+	smf->lazy_buffer_mapped = mapped;
+
+	return (smf);
+}
+
+/**
+ * Loads SMF file, parsing tracks using "number_of_threads" threads.  See smf_load_from_memory_parallel().
+ *
+ * \param file_name Path to the file.
+ * \param number_of_threads Number of threads to use, or zero to use one thread per processor.
+ * \return SMF or NULL, if loading failed.
+ */
+smf_t *
+smf_load_parallel(const char *file_name, int number_of_threads)
+{
+	smf_load_options_t options;
+
+	smf_load_options_init(&options);
+	options.number_of_threads = number_of_threads;
+
+	return (smf_load_with_options(file_name, &options));
+}
+
+/** Used by probe_message(). */
+struct probe_scan_struct {
+	smf_probe_t		*probe;
+	smf_probe_chunk_t	*chunk;
+	int			allocated_tempos;
+};
+
+static int
+probe_message(int pulses, const struct midi_message_struct *message, void *user_pointer)
+{
+	struct probe_scan_struct *scan = user_pointer;
+	smf_probe_t *probe = scan->probe;
+	smf_probe_chunk_t *chunk = scan->chunk;
+	smf_probe_tempo_t *tempo, *tmp;
+	const unsigned char *data = message->data;
+	int length;
+
+	chunk->number_of_events++;
+	chunk->length_pulses = pulses;
+
+	if (message->status != 0xFF)
+		return (0);
+
+	/* Metaevent: type, length and then "length" bytes of data. */
+	length = data[1];
+
+	if (data[0] == 0x03 && chunk->track_name == NULL && length > 0) {
+		chunk->track_name = make_string(data + 2, message->data_length - 2, length);
+		if (chunk->track_name == NULL)
+			return (-1);
+	}
+
+	if (data[0] != 0x51 || length < 3)
+		return (0);
+
+	if (probe->number_of_tempos == scan->allocated_tempos) {
+		scan->allocated_tempos = scan->allocated_tempos ? scan->allocated_tempos * 2 : 16;
+		tmp = realloc(probe->tempos, scan->allocated_tempos * sizeof(smf_probe_tempo_t));
+		if (tmp == NULL) {
+			g_critical("Cannot allocate memory in probe_message(): %s", strerror(errno));
+			return (-1);
+		}
+
+		probe->tempos = tmp;
+	}
+
+	tempo = &(probe->tempos[probe->number_of_tempos]);
+	tempo->track_number = chunk->track_number;
+	tempo->time_pulses = pulses;
+	tempo->microseconds_per_quarter_note = (data[2] << 16) + (data[3] << 8) + data[4];
+
+	probe->number_of_tempos++;
+
+	return (0);
+}
+
+/**
+ * Examines SMF in "buffer" without loading it.  See smf_probe().
+ *
+ * \param buffer Pointer to the SMF data.
+ * \param buffer_length Length of the data, in bytes.
+ * \param flags Zero, or SMF_PROBE_META.
+ * \return Probe, to be freed using smf_probe_delete(), or NULL, if the data is not SMF libsmf could load.
+ */
+smf_probe_t *
+smf_probe_from_memory(const void *buffer, const int buffer_length, int flags)
+{
+	int allocated_chunks = 0;
+	smf_t smf;
+	smf_probe_t *probe;
+	smf_probe_chunk_t *chunk, *tmp;
+	struct chunk_header_struct *header;
+	struct probe_scan_struct scan;
+
+	/* parse_mthd_chunk() and next_chunk() need nothing but the MThd and buffer fields. */
+	memset(&smf, 0, sizeof(smf));
+	smf.file_buffer = (void *)buffer;
+	smf.file_buffer_length = buffer_length;
+	smf.next_chunk_offset = 0;
+
+	if (parse_mthd_chunk(&smf))
+		return (NULL);
+
+	probe = malloc(sizeof(smf_probe_t));
+	if (probe == NULL) {
+		g_critical("Cannot allocate smf_probe_t structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(probe, 0, sizeof(smf_probe_t));
+
+	probe->format = smf.format;
+	probe->ppqn = smf.ppqn;
+	probe->frames_per_second = smf.frames_per_second;
+	probe->resolution = smf.resolution;
+	probe->expected_number_of_tracks = smf.expected_number_of_tracks;
+
+	memset(&scan, 0, sizeof(scan));
+	scan.probe = probe;
+
+	/* Checking this here avoids the warning from next_chunk() at the end of file. */
+	while (smf.next_chunk_offset + sizeof(struct chunk_header_struct) < smf.file_buffer_length) {
+		header = next_chunk(&smf);
+		if (header == NULL)
+			break;
+
+		if (probe->number_of_chunks == allocated_chunks) {
+			allocated_chunks = allocated_chunks ? allocated_chunks * 2 : 16;
+			tmp = realloc(probe->chunks, allocated_chunks * sizeof(smf_probe_chunk_t));
+			if (tmp == NULL) {
+				g_critical("Cannot allocate memory in smf_probe_from_memory(): %s", strerror(errno));
+				smf_probe_delete(probe);
+				return (NULL);
+			}
+
+			probe->chunks = tmp;
+		}
+
+		chunk = &(probe->chunks[probe->number_of_chunks]);
+		memset(chunk, 0, sizeof(smf_probe_chunk_t));
+		probe->number_of_chunks++;
+
+		memcpy(chunk->id, header->id, 4);
+		chunk->id[4] = '\0';
+		chunk->offset = (unsigned char *)header - (unsigned char *)buffer;
+		chunk->length = MIN(ntohl(header->length), INT_MAX);
+		chunk->truncated = (chunk->length > buffer_length - chunk->offset - (int)sizeof(struct chunk_header_struct));
+
+		if (!chunk_signature_matches(header, "MTrk"))
+			continue;
+
+		/* smf_load() reads only as many chunks as the MThd declares. */
+		if (probe->number_of_chunks <= probe->expected_number_of_tracks) {
+			probe->number_of_tracks++;
+			chunk->track_number = probe->number_of_tracks;
+		}
+
+		if (!(flags & SMF_PROBE_META))
+			continue;
+
+		scan.chunk = chunk;
+
+		if (walk_mtrk_chunk(header, (unsigned char *)buffer + smf.next_chunk_offset - (unsigned char *)header,
+		    probe_message, &scan))
+			chunk->malformed = 1;
+	}
+
+	return (probe);
+}
+
+/**
+ * Examines SMF file without loading it.  Fills the information from MThd header and the list of chunks,
+ * with their offsets and lengths; with SMF_PROBE_META in "flags", it also scans MTrk chunks for track names
+ * and tempo changes.  Nothing gets allocated for the events, and without SMF_PROBE_META, only the chunk
+ * headers are read, so this is much faster than smf_load().  Use it to find out whether the file is worth loading.
+ *
+ * \param file_name Path to the file.
+ * \param flags Zero, or SMF_PROBE_META.
+ * \return Probe, to be freed using smf_probe_delete(), or NULL, if the file is not SMF libsmf could load.
+ */
+smf_probe_t *
+smf_probe(const char *file_name, int flags)
+{
+	int file_buffer_length, mapped;
+	void *file_buffer;
+	smf_probe_t *probe;
+
+	if (get_file_buffer(&file_buffer, &file_buffer_length, &mapped, file_name))
+		return (NULL);
+
+	probe = smf_probe_from_memory(file_buffer, file_buffer_length, flags);
+
+	free_file_buffer(file_buffer, file_buffer_length, mapped);
+
+	return (probe);
+}
+
+/**
+ * Frees the probe returned by smf_probe().
+ */
+void
+smf_probe_delete(smf_probe_t *probe)
+{
+	int i;
+
+	for (i = 0; i < probe->number_of_chunks; i++)
+		free(probe->chunks[i].track_name);
+
+	free(probe->chunks);
+	free(probe->tempos);
+
+	memset(probe, 0, sizeof(smf_probe_t));
+	free(probe);
+}
+
+enum parser_state {
+	PARSER_MTHD,		/* Waiting for MThd chunk. */
+	PARSER_CHUNK_HEADER,	/* Waiting for the header of the next chunk. */
+	PARSER_MTRK_EVENTS,	/* Inside MTrk chunk, waiting for the next event. */
+	PARSER_SKIP_CHUNK,	/* Skipping the rest of the chunk. */
+	PARSER_DONE,		/* All the tracks were read; ignoring the rest of the input. */
+	PARSER_ERROR
+};
+
+/** Incremental SMF parser; see smf_parser_new(). */
+struct smf_parser_struct {
+	smf_t			*smf;
+	smf_parser_callback_t	callback;
+	void			*user_pointer;
+	enum parser_state	state;
+
+	/** Data received, but not parsed yet, because it does not contain the whole event. */
+	unsigned char		*buffer;
+	int			buffer_length;
+	int			allocated;
+
+	/** Number of chunks seen so far and number of bytes in the current chunk not parsed yet. */
+	int			number_of_chunks;
+	int			chunk_remaining;
+
+	/** Track being parsed and the state of its parsing. */
+	smf_track_t		*track;
+	int			pulses;
+	int			last_status;
+};
+
+/**
+ * Returns the number of bytes the event at "buf" (including delta time) takes, or 0 if that cannot
+ * be determined from "buffer_length" bytes available; more data is needed then.  It does not validate
+ * anything; malformed events are left for decode_event() to complain about.
+ */
+static int
+event_length_if_known(const unsigned char *buf, const int buffer_length, int last_status)
+{
+	int i, status, value, message_length;
+	const unsigned char *c = buf, *end = buf + buffer_length;
+
+	/* Delta time. */
+	for (i = 0; c < end && i < 4 && (*c & 0x80); i++)
+		c++;
+
+	if (c == end)
+		return (0);
+
+	c++;
+
+	if (i == 4)
+		return (c - buf);
+
+	if (c == end)
+		return (0);
+
+	if (is_status_byte(*c))
+		status = *c++;
+	else if (is_sysex_byte(last_status) || is_escape_byte(last_status))
+		return (c - buf);
+	else
+		status = last_status;
+
+	if (!is_status_byte(status))
+		return (c - buf);
+
+	if (is_sysex_byte(status) || is_escape_byte(status)) {
+		for (value = 0, i = 0; i < 4; i++) {
+			if (c == end)
+				return (0);
+
+			value = (value << 7) + (*c & 0x7F);
+
+			if (!(*c++ & 0x80))
+				break;
+		}
+
+		if (i == 4)
+			return (c - buf);
+
+		message_length = c - buf + value;
+
+	} else if (status_byte_table[status] == METAEVENT_STATUS) {
+		if (end - c < 2)
+			return (0);
+
+		message_length = c - buf + 2 + c[1];
+
+	} else if (status_byte_table[status] > 0) {
+		message_length = c - buf + status_byte_table[status] - 1;
+
+	} else {
+		return (c - buf);
+	}
+
+	if (message_length > buffer_length)
+		return (0);
+
+	return (message_length);
+}
+
+/**
+ * Creates event from "message", adds it to the track being parsed and calls the callback.
+ */
+static int
+parser_add_message(smf_parser_t *parser, const struct midi_message_struct *message)
+{
+	smf_event_t *event;
+
+	/* No arena here; callback may delete events it does not need, and we want the memory back. */
+	event = new_event_from_message(parser->track, message);
+	if (event == NULL)
+		return (-1);
+
+	smf_track_add_event_pulses(parser->track, event, parser->pulses);
+
+	assert(smf_event_is_valid(event));
+
+	if (parser->callback != NULL)
+		parser->callback(event, parser->user_pointer);
+
+	return (0);
+}
+
+/**
+ * Ends malformed or truncated track being parsed, adding End Of Track to it.
+ */
+static int
+parser_truncate_track(smf_parser_t *parser)
+{
+	static const unsigned char eot_data[] = {0x2F, 0x00};
+	struct midi_message_struct eot;
+
+	g_critical("Unable to parse MIDI event; truncating track.");
+
+	eot.status = 0xFF;
+	eot.data = eot_data;
+	eot.data_length = sizeof(eot_data);
+
+	parser->state = PARSER_SKIP_CHUNK;
+
+	if (parser_add_message(parser, &eot)) {
+		g_critical("Cannot add End Of Track to truncated track.");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/**
+ * Parses the next piece of "buf" - MThd chunk, chunk header or an event.  If "final" is nonzero,
+ * there will be no more data, so anything incomplete is an error.
+ * Returns the number of bytes consumed, -1 if more data is needed, or -2 in case of error.
+ */
+static int
+parser_step(smf_parser_t *parser, const unsigned char *buf, const int buffer_length, int final)
+{
+	int ret, length, delta, len;
+	struct chunk_header_struct *chunk;
+	struct midi_message_struct message;
+	smf_t *smf = parser->smf;
+
+	switch (parser->state) {
+		case PARSER_MTHD:
+			if (buffer_length < sizeof(struct mthd_chunk_struct))
+				return (-1);
+
+			smf->file_buffer = (void *)buf;
+			smf->file_buffer_length = sizeof(struct mthd_chunk_struct);
+			smf->next_chunk_offset = 0;
+
+			ret = parse_mthd_chunk(smf);
+
+			smf->file_buffer = NULL;
+			smf->file_buffer_length = 0;
+			smf->next_chunk_offset = -1;
+
+			if (ret)
+				return (-2);
+
+			parser->state = PARSER_CHUNK_HEADER;
+
+			return (sizeof(struct mthd_chunk_struct));
+
+		case PARSER_CHUNK_HEADER:
+			if (parser->number_of_chunks == smf->expected_number_of_tracks) {
+				parser->state = PARSER_DONE;
+				return (0);
+			}
+
+			if (buffer_length < sizeof(struct chunk_header_struct))
+				return (-1);
+
+			chunk = (struct chunk_header_struct *)buf;
+
+			if (!isalpha(chunk->id[0]) || !isalpha(chunk->id[1]) || !isalpha(chunk->id[2]) || !isalpha(chunk->id[3])) {
+				g_critical("SMF error: chunk signature contains at least one non-alphanumeric byte.");
+				parser->state = PARSER_DONE;
+				return (0);
+			}
+
+			parser->number_of_chunks++;
+			parser->chunk_remaining = MIN(ntohl(chunk->length), INT_MAX);
+
+			if (!chunk_signature_matches(chunk, "MTrk")) {
+				g_warning("SMF warning: Expected MTrk signature, got %c%c%c%c instead; ignoring this chunk.",
+						chunk->id[0], chunk->id[1], chunk->id[2], chunk->id[3]);
+
+				parser->state = PARSER_SKIP_CHUNK;
+				return (sizeof(struct chunk_header_struct));
+			}
+
+			parser->track = smf_track_new();
+			if (parser->track == NULL)
+				return (-2);
+
+			smf_add_track(smf, parser->track);
+
+			parser->pulses = 0;
+			parser->last_status = 0;
+			parser->state = PARSER_MTRK_EVENTS;
+
+			return (sizeof(struct chunk_header_struct));
+
+		case PARSER_MTRK_EVENTS:
+			length = MIN(buffer_length, parser->chunk_remaining);
+
+			if (length == 0) {
+				if (parser->chunk_remaining > 0 && !final)
+					return (-1);
+
+				if (parser->chunk_remaining == 0)
+					g_critical("SMF error: MTrk chunk ends without End Of Track.");
+				else
+					g_critical("SMF warning: malformed chunk; truncated file?");
+
+				if (parser_truncate_track(parser))
+					return (-2);
+
+				return (0);
+			}
+
+			if (!final && length < parser->chunk_remaining &&
+			    event_length_if_known(buf, length, parser->last_status) == 0)
+				return (-1);
+
+			if (decode_event(buf, length, &delta, &message, &len, parser->last_status)) {
+				if (parser_truncate_track(parser))
+					return (-2);
+
+				return (0);
+			}
+
+			parser->pulses += delta;
+			parser->last_status = message_first_byte(&message);
+			parser->chunk_remaining -= len;
+
+			/* Anything after End Of Track gets ignored. */
+			if (message_is_end_of_track(&message))
+				parser->state = PARSER_SKIP_CHUNK;
+
+			if (parser_add_message(parser, &message))
+				return (-2);
+
+			return (len);
+
+		case PARSER_SKIP_CHUNK:
+			length = MIN(buffer_length, parser->chunk_remaining);
+			parser->chunk_remaining -= length;
+
+			if (parser->chunk_remaining == 0) {
+				parser->track = NULL;
+				parser->state = PARSER_CHUNK_HEADER;
+				return (length);
+			}
+
+			if (length == 0)
+				return (-1);
+
+			return (length);
+
+		default:
+			/* PARSER_DONE and PARSER_ERROR ignore everything. */
+			return (buffer_length);
+	}
+}
+
+/**
+ * Parses as much of "buf" as possible.  Returns the number of bytes consumed, or -1 in case of error.
+ */
+static int
+parser_run(smf_parser_t *parser, const unsigned char *buf, const int buffer_length, int final)
+{
+	int ret, consumed = 0;
+
+	while (parser->state != PARSER_DONE && parser->state != PARSER_ERROR) {
+		ret = parser_step(parser, buf + consumed, buffer_length - consumed, final);
+
+		if (ret == -1)
+			break;
+
+		if (ret < 0) {
+			parser->state = PARSER_ERROR;
+			return (-1);
+		}
+
+		consumed += ret;
+	}
+
+	/* Ignore anything following the last track. */
+	if (parser->state == PARSER_DONE)
+		return (buffer_length);
+
+	return (consumed);
+}
+
+/**
+ * Creates new incremental parser.  Use it to load SMF that arrives in pieces, e.g. from a pipe or socket:
+ * pass every piece to smf_parser_feed() as it arrives and call smf_parser_finish() at the end of input.
+ * Events are parsed as soon as all their bytes are received; only the incomplete event is kept
+ * in the parser.
+ *
+ * After each event gets added to its track, "callback" (if not NULL) is called with the event
+ * and "user_pointer".  Callback may remove the event from the track and delete it, e.g. after
+ * sending it somewhere, so that the whole song does not need to be kept in memory.  Note that
+ * event->time_seconds is computed using the tempo map built from events parsed so far, just like
+ * smf_track_add_event_pulses() does.  For format 1 files, tempo changes are in the first track,
+ * so the times are correct, unless you delete Tempo Change metaevents.
+ *
+ * \param callback Function to call for every parsed event, or NULL.
+ * \param user_pointer Passed to callback.
+ * \return Parser or NULL, if allocation failed.
+ */
+smf_parser_t *
+smf_parser_new(smf_parser_callback_t callback, void *user_pointer)
+{
+	smf_parser_t *parser = malloc(sizeof(smf_parser_t));
+	if (parser == NULL) {
+		g_critical("Cannot allocate smf_parser_t structure: %s", strerror(errno));
+		return (NULL);
+	}
+
+	memset(parser, 0, sizeof(smf_parser_t));
+
+	parser->smf = smf_new();
+	if (parser->smf == NULL) {
+		free(parser);
+		return (NULL);
+	}
+
+	parser->callback = callback;
+	parser->user_pointer = user_pointer;
+	parser->state = PARSER_MTHD;
+
+	return (parser);
+}
+
+/**
+ * Parses next "buffer_length" bytes of SMF.  Complete events are added to tracks (and passed
+ * to the callback) before this function returns; the rest is kept until more data arrives.
+ *
+ * \param parser Parser created using smf_parser_new().
+ * \param buffer Data to parse.
+ * \param buffer_length Length of the data, in bytes.
+ * \return 0 if everything went OK, different value if the data is not SMF or cannot be parsed.
+ * In that case, subsequent calls will fail too; call smf_parser_finish() to free the parser.
+ */
+int
+smf_parser_feed(smf_parser_t *parser, const void *buffer, int buffer_length)
+{
+	int consumed, new_allocated;
+	unsigned char *new_buffer;
+
+	assert(buffer_length >= 0);
+
+	if (parser->state == PARSER_ERROR)
+		return (-1);
+
+	/* Usually, there is nothing left from previous call, so we can parse directly from the "buffer". */
+	if (parser->buffer_length == 0) {
+		consumed = parser_run(parser, buffer, buffer_length, 0);
+		if (consumed < 0)
+			return (-2);
+
+		buffer = (const unsigned char *)buffer + consumed;
+		buffer_length -= consumed;
+
+		if (buffer_length == 0)
+			return (0);
+	}
+
+	if (parser->buffer_length + buffer_length > parser->allocated) {
+		new_allocated = MAX(parser->allocated * 2, parser->buffer_length + buffer_length);
+
+		new_buffer = realloc(parser->buffer, new_allocated);
+		if (new_buffer == NULL) {
+			g_critical("Cannot allocate parser buffer: %s", strerror(errno));
+			parser->state = PARSER_ERROR;
+			return (-3);
+		}
+
+		parser->buffer = new_buffer;
+		parser->allocated = new_allocated;
+	}
+
+	memcpy(parser->buffer + parser->buffer_length, buffer, buffer_length);
+	parser->buffer_length += buffer_length;
+
+	/* Data coming directly from the "buffer" above was already parsed as far as it could be. */
+	if (parser->buffer_length == buffer_length)
+		return (0);
+
+	consumed = parser_run(parser, parser->buffer, parser->buffer_length, 0);
+	if (consumed < 0)
+		return (-4);
+
+	parser->buffer_length -= consumed;
+	memmove(parser->buffer, parser->buffer + consumed, parser->buffer_length);
+
+	return (0);
+}
+
+/**
+ * Finishes parsing and frees the parser.  Tracks that were not complete get truncated,
+ * like smf_load() does with truncated files.
+ *
+ * \param parser Parser created using smf_parser_new().
+ * \return SMF, rewound to the start of the song, or NULL, if parsing failed.
+ */
+smf_t *
+smf_parser_finish(smf_parser_t *parser)
+{
+	smf_t *smf = parser->smf;
+
+	if (parser->state != PARSER_ERROR && parser->state != PARSER_DONE) {
+		if (parser_run(parser, parser->buffer, parser->buffer_length, 1) >= 0) {
+			if (parser->state == PARSER_MTHD) {
+				g_critical("SMF error: file is too short, it cannot be a MIDI file.");
+				parser->state = PARSER_ERROR;
+			}
+		}
+	}
+
+	free(parser->buffer);
+
+	if (parser->state == PARSER_ERROR) {
+		free(parser);
+		smf_delete(smf);
+
+		return (NULL);
+	}
+
+	free(parser);
+
+	if (smf->expected_number_of_tracks != smf->number_of_tracks) {
+		g_warning("SMF warning: MThd header declared %d tracks, but only %d found; continuing anyway.",
+				smf->expected_number_of_tracks, smf->number_of_tracks);
+
+		smf->expected_number_of_tracks = smf->number_of_tracks;
+	}
+
+	smf_rewind(smf);
+
+	return (smf);
+}
+
+/** Used by smf_load_many() and friends. */
+struct load_many_struct {
+	const char		**file_names;
+	const void		**buffers;
+	const int		*buffer_lengths;
+	smf_load_many_callback_t	callback;
+	void			*user_pointer;
+	volatile gint		number_of_failures;
+};
+
+/** Used by smf_load_many() and friends; one per file. */
+struct load_many_job_struct {
+	struct load_many_struct	*batch;
+	int			number;
+};
+
+static void
+load_many_job(gpointer data, gpointer user_data)
+{
+	struct load_many_job_struct *job = data;
+	struct load_many_struct *batch = job->batch;
+	smf_t *smf;
+	(void) user_data;
+
+	/* Every smf_t is used by one thread only, so there is nothing to lock here. */
+	if (batch->file_names != NULL)
+		smf = smf_load(batch->file_names[job->number]);
+	else
+		smf = smf_load_from_memory(batch->buffers[job->number], batch->buffer_lengths[job->number]);
+
+	if (smf == NULL)
+		g_atomic_int_inc(&(batch->number_of_failures));
+
+	batch->callback(job->number, smf, batch->user_pointer);
+}
+
+/**
+ * Loads "number_of_files" files described by "batch", using "number_of_threads" threads.
+ * Returns the number of files that could not be loaded, or -1 in case of error.
+ */
+static int
+load_many(struct load_many_struct *batch, int number_of_files, int number_of_threads)
+{
+	int i;
+	GThreadPool *pool = NULL;
+	struct load_many_job_struct *jobs;
+
+	assert(number_of_files >= 0);
+
+	if (number_of_files == 0)
+		return (0);
+
+	jobs = calloc(number_of_files, sizeof(struct load_many_job_struct));
+	if (jobs == NULL) {
+		g_critical("Cannot allocate memory in load_many(): %s", strerror(errno));
+		return (-1);
+	}
+
+	if (number_of_threads < 1)
+		number_of_threads = g_get_num_processors();
+
+	if (number_of_threads > number_of_files)
+		number_of_threads = number_of_files;
+
+	if (number_of_threads > 1) {
+		pool = g_thread_pool_new(load_many_job, NULL, number_of_threads, TRUE, NULL);
+		if (pool == NULL)
+			g_warning("Cannot create thread pool; loading files sequentially.");
+	}
+
+	batch->number_of_failures = 0;
+
+	for (i = 0; i < number_of_files; i++) {
+		jobs[i].batch = batch;
+		jobs[i].number = i;
+
+		if (pool == NULL || !g_thread_pool_push(pool, &(jobs[i]), NULL))
+			load_many_job(&(jobs[i]), NULL);
+	}
+
+	/* Wait for the workers to finish. */
+	if (pool != NULL)
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+	free(jobs);
+
+	return (batch->number_of_failures);
+}
+
+static void
+store_loaded_smf(int number, smf_t *smf, void *user_pointer)
+{
+	smf_t **smfs = user_pointer;
+
+	smfs[number] = smf;
+}
+
+/**
+ * Loads many SMF files at once, using "number_of_threads" threads.  Every file is loaded just like
+ * smf_load() would do it; "smfs[i]" is set to the SMF loaded from "file_names[i]", or to NULL,
+ * if loading failed.  All of the loaded SMFs are kept in memory until the caller deletes them;
+ * use smf_load_many_with_callback() if you don't want to keep all of them in memory at the same time.
+ *
+ * \param file_names Paths to the files.
+ * \param number_of_files Number of elements in "file_names" and "smfs".
+ * \param smfs Array the loaded SMFs are stored into.
+ * \param number_of_threads Number of threads to use, or zero to use one thread per processor.
+ * \return Number of files that could not be loaded, or -1, if there was a different error.
+ */
+int
+smf_load_many(const char **file_names, int number_of_files, smf_t **smfs, int number_of_threads)
+{
+	struct load_many_struct batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.file_names = file_names;
+	batch.callback = store_loaded_smf;
+	batch.user_pointer = smfs;
+
+	return (load_many(&batch, number_of_files, number_of_threads));
+}
+
+/**
+ * Like smf_load_many(), but loads SMFs from buffers, like smf_load_from_memory() does.
+ *
+ * \param buffers Pointers to the SMF data.
+ * \param buffer_lengths Lengths of the data, in bytes.
+ * \param number_of_files Number of elements in "buffers", "buffer_lengths" and "smfs".
+ * \param smfs Array the loaded SMFs are stored into.
+ * \param number_of_threads Number of threads to use, or zero to use one thread per processor.
+ * \return Number of files that could not be loaded, or -1, if there was a different error.
+ */
+int
+smf_load_many_from_memory(const void **buffers, const int *buffer_lengths, int number_of_files, smf_t **smfs,
+	int number_of_threads)
+{
+	struct load_many_struct batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.buffers = buffers;
+	batch.buffer_lengths = buffer_lengths;
+	batch.callback = store_loaded_smf;
+	batch.user_pointer = smfs;
+
+	return (load_many(&batch, number_of_files, number_of_threads));
+}
+
+/**
+ * Like smf_load_many(), but instead of storing the loaded SMFs, passes every one of them to the "callback",
+ * as soon as it's loaded, along with the index of its file in "file_names" and "user_pointer".  SMF (NULL
+ * if loading failed) belongs to the callback, which should process it and then call smf_delete().
+ * Every worker thread waits for the callback to return before it loads the next file, so if the callback
+ * deletes every SMF it gets, no more than "number_of_threads" files are kept in memory at the same time.
+ * SMFs kept by the callback are not limited in any way.  Note that the callback gets called from several
+ * threads at once.
+ *
+ * \param file_names Paths to the files.
+ * \param number_of_files Number of elements in "file_names".
+ * \param callback Function to call for every file.
+ * \param user_pointer Passed to the callback.
+ * \param number_of_threads Number of threads to use, or zero to use one thread per processor.
+ * \return Number of files that could not be loaded, or -1, if there was a different error.
+ */
+int
+smf_load_many_with_callback(const char **file_names, int number_of_files, smf_load_many_callback_t callback,
+	void *user_pointer, int number_of_threads)
+{
+	struct load_many_struct batch;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.file_names = file_names;
+	batch.callback = callback;
+	batch.user_pointer = user_pointer;
+
+	return (load_many(&batch, number_of_files, number_of_threads));
+}
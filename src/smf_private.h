@@ -67,11 +67,40 @@ struct mthd_chunk_struct {
 #pragma pack()
 #endif
 
+typedef struct smf_arena_struct smf_arena_t;
+
+smf_arena_t *smf_arena_new(void) WARN_UNUSED_RESULT;
+void smf_arena_ref(smf_arena_t *arena);
+void smf_arena_unref(smf_arena_t *arena);
+void *smf_arena_alloc(smf_arena_t *arena, size_t length) WARN_UNUSED_RESULT;
+int smf_arena_offset(const smf_arena_t *arena, const void *ptr);
+smf_arena_t *smf_arena_of(const void *ptr, int offset);
+int smf_arena_number_of_blocks(const smf_arena_t *arena) WARN_UNUSED_RESULT;
+smf_event_t *smf_event_new_from_arena(smf_arena_t *arena, int midi_buffer_length) WARN_UNUSED_RESULT;
+int smf_event_allocate_midi_buffer(smf_event_t *event, int midi_buffer_length) WARN_UNUSED_RESULT;
+
 void smf_track_add_event(smf_track_t *track, smf_event_t *event);
+void smf_track_append_event(smf_track_t *track, smf_event_t *event);
+void smf_track_parse_lazy(smf_track_t *track);
+int smf_extract_vlq(const unsigned char *buf, const int buffer_length, int *value, int *len);
+int smf_expected_message_length(unsigned char status, const unsigned char *second_byte, const int buffer_length) WARN_UNUSED_RESULT;
+void smf_track_renumber_events(smf_track_t *track);
+int smf_track_find_position_pulses(const smf_track_t *track, int pulses) WARN_UNUSED_RESULT;
+int smf_track_find_position_seconds(const smf_track_t *track, double seconds) WARN_UNUSED_RESULT;
+int smf_event_index(const smf_event_t *event) WARN_UNUSED_RESULT;
+smf_track_t *smf_track_of_event(const smf_t *smf, const smf_event_t *event) WARN_UNUSED_RESULT;
+void smf_build_length_heap(smf_t *smf);
+void smf_frozen_unref(smf_t *smf);
+int smf_refuse_if_frozen(const smf_t *smf, const char *function_name) WARN_UNUSED_RESULT;
+void smf_track_update_length(smf_track_t *track);
+void smf_release_lazy_buffer(smf_t *smf);
 void smf_init_tempo(smf_t *smf);
 void smf_fini_tempo(smf_t *smf);
+int smf_copy_tempo_map(smf_t *smf, const smf_t *source) WARN_UNUSED_RESULT;
 void smf_create_tempo_map_and_compute_seconds(smf_t *smf);
-void maybe_add_to_tempo_map(smf_event_t *event);
+void smf_track_compute_seconds(smf_track_t *track);
+void maybe_add_to_tempo_map(smf_t *smf, const smf_event_t *event);
+void maybe_add_message_to_tempo_map(smf_t *smf, int pulses, const unsigned char *midi_buffer, int midi_buffer_length);
 void remove_last_tempo_with_pulses(smf_t *smf, int pulses);
 int smf_event_is_tempo_change_or_time_signature(const smf_event_t *event) WARN_UNUSED_RESULT;
 int smf_event_length_is_valid(const smf_event_t *event) WARN_UNUSED_RESULT;
@@ -50,61 +50,70 @@
 #define MAX_VLQ_LENGTH 128
 
 /**
- * Extends (reallocates) smf->file_buffer and returns pointer to the newly added space,
+ * File contents being built by smf_save().  It's kept apart from the smf, so that saving does not modify it.
+ */
+struct save_buffer_struct {
+	unsigned char	*data;
+	int		length;
+	int		allocated;
+};
+
+/**
+ * Extends (reallocates) buffer->data and returns pointer to the newly added space,
  * that is, pointer to the first byte after the previous buffer end.  Returns NULL in case
  * of error.
  */
 static void *
-smf_extend(smf_t *smf, const int length)
+buffer_extend(struct save_buffer_struct *buffer, const int length)
 {
-	int i, previous_file_buffer_length = smf->file_buffer_length;
-	char *previous_file_buffer = smf->file_buffer;
-
-	/* XXX: Not terribly efficient. */
-	smf->file_buffer_length += length;
-	smf->file_buffer = realloc(smf->file_buffer, smf->file_buffer_length);
-	if (smf->file_buffer == NULL) {
-		g_critical("realloc(3) failed: %s", strerror(errno));
-		smf->file_buffer_length = 0;
-		return (NULL);
-	}
+	int allocated;
+	unsigned char *data;
+
+	if (buffer->length + length > buffer->allocated) {
+		allocated = buffer->allocated > 0 ? buffer->allocated : 4096;
+		while (allocated < buffer->length + length)
+			allocated *= 2;
+
+		data = realloc(buffer->data, allocated);
+		if (data == NULL) {
+			g_critical("realloc(3) failed: %s", strerror(errno));
+			return (NULL);
+		}
 
-	/* Fix up pointers.  XXX: omgwtf. */
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		smf_track_t *track;
-		track = smf_get_track_by_number(smf, i);
-		if (track->file_buffer != NULL)
-			track->file_buffer = (char *)track->file_buffer + ((char *)smf->file_buffer - previous_file_buffer);
+		buffer->data = data;
+		buffer->allocated = allocated;
 	}
 
-	return ((char *)smf->file_buffer + previous_file_buffer_length);
+	buffer->length += length;
+
+	return (buffer->data + buffer->length - length);
 }
 
 /**
- * Appends "buffer_length" bytes pointed to by "buffer" to the smf, reallocating storage as needed.  Returns 0
+ * Appends "buffer_length" bytes pointed to by "data" to the buffer, reallocating storage as needed.  Returns 0
  * if everything went ok, different value if there was any problem.
  */
 static int
-smf_append(smf_t *smf, const void *buffer, const int buffer_length)
+buffer_append(struct save_buffer_struct *buffer, const void *data, const int data_length)
 {
 	void *dest;
 
-	dest = smf_extend(smf, buffer_length);
+	dest = buffer_extend(buffer, data_length);
 	if (dest == NULL) {
-		g_critical("Cannot extend track buffer.");
+		g_critical("Cannot extend file buffer.");
 		return (-1);
 	}
 
-	memcpy(dest, buffer, buffer_length);
+	memcpy(dest, data, data_length);
 
 	return (0);
 }
 
 /**
- * Appends MThd header to the track.  Returns 0 if everything went ok, different value if not.
+ * Appends MThd header to the buffer.  Returns 0 if everything went ok, different value if not.
  */
 static int
-write_mthd_header(smf_t *smf)
+write_mthd_header(struct save_buffer_struct *buffer, const smf_t *smf)
 {
 	struct mthd_chunk_struct mthd_chunk;
 
@@ -114,50 +123,7 @@ write_mthd_header(smf_t *smf)
 	mthd_chunk.number_of_tracks = htons(smf->number_of_tracks);
 	mthd_chunk.division = htons(smf->ppqn);
 
-	return (smf_append(smf, &mthd_chunk, sizeof(mthd_chunk)));
-}
-
-/**
- * Extends (reallocates) track->file_buffer and returns pointer to the newly added space,
- * that is, pointer to the first byte after the previous buffer end.  Returns NULL in case
- * of error.
- */
-static void *
-track_extend(smf_track_t *track, const int length)
-{
-	void *buf;
-
-	assert(track->smf);
-
-	buf = smf_extend(track->smf, length);
-	if (buf == NULL)
-		return (NULL);
-
-	track->file_buffer_length += length;
-	if (track->file_buffer == NULL)
-		track->file_buffer = buf;
-
-	return (buf);
-}
-
-/**
- * Appends "buffer_length" bytes pointed to by "buffer" to the track, reallocating storage as needed.  Returns 0
- * if everything went ok, different value if there was any problem.
- */
-static int
-track_append(smf_track_t *track, const void *buffer, const int buffer_length)
-{
-	void *dest;
-
-	dest = track_extend(track, buffer_length);
-	if (dest == NULL) {
-		g_critical("Cannot extend track buffer.");
-		return (-1);
-	}
-
-	memcpy(dest, buffer, buffer_length);
-
-	return (0);
+	return (buffer_append(buffer, &mthd_chunk, sizeof(mthd_chunk)));
 }
 
 static int
@@ -227,17 +193,17 @@ smf_event_new_textual(int type, const char *text)
 }
 
 /**
-  * Appends value, expressed as Variable Length Quantity, to event->track.
+  * Appends value, expressed as Variable Length Quantity, to the buffer.
   */
 static int
-write_vlq(smf_event_t *event, unsigned long value)
+write_vlq(struct save_buffer_struct *buffer, unsigned long value)
 {
 	unsigned char buf[MAX_VLQ_LENGTH];
 	int vlq_length;
 
 	vlq_length = format_vlq(buf, MAX_VLQ_LENGTH, value);
 
-	return (track_append(event->track, buf, vlq_length));
+	return (buffer_append(buffer, buf, vlq_length));
 }
 
 /**
@@ -245,31 +211,31 @@ write_vlq(smf_event_t *event, unsigned long value)
  * different value in case of error.
  */
 static int
-write_event_time(smf_event_t *event)
+write_event_time(struct save_buffer_struct *buffer, const smf_event_t *event)
 {
 	assert(event->delta_time_pulses >= 0);
 
-	return (write_vlq(event, event->delta_time_pulses));
+	return (write_vlq(buffer, event->delta_time_pulses));
 }
 
 static int
-write_sysex_contents(smf_event_t *event)
+write_sysex_contents(struct save_buffer_struct *buffer, const smf_event_t *event)
 {
 	int ret;
 	unsigned char sysex_status = 0xF0;
 
 	assert(smf_event_is_sysex(event));
 
-	ret = track_append(event->track, &sysex_status, 1);
+	ret = buffer_append(buffer, &sysex_status, 1);
 	if (ret)
 		return (ret);
 
 	/* -1, because length does not include status byte. */
-	ret = write_vlq(event, event->midi_buffer_length - 1);
+	ret = write_vlq(buffer, event->midi_buffer_length - 1);
 	if (ret)
 		return (ret);
 
-	ret = track_append(event->track, event->midi_buffer + 1, event->midi_buffer_length - 1);
+	ret = buffer_append(buffer, event->midi_buffer + 1, event->midi_buffer_length - 1);
 	if (ret)
 		return (ret);
 
@@ -280,23 +246,23 @@ write_sysex_contents(smf_event_t *event)
   * Appends contents of event->midi_buffer wrapped into 0xF7 MIDI event.
   */
 static int
-write_escaped_event_contents(smf_event_t *event)
+write_escaped_event_contents(struct save_buffer_struct *buffer, const smf_event_t *event)
 {
 	int ret;
 	unsigned char escape_status = 0xF7;
 
 	if (smf_event_is_sysex(event))
-		return (write_sysex_contents(event));
+		return (write_sysex_contents(buffer, event));
 
-	ret = track_append(event->track, &escape_status, 1);
+	ret = buffer_append(buffer, &escape_status, 1);
 	if (ret)
 		return (ret);
 
-	ret = write_vlq(event, event->midi_buffer_length);
+	ret = write_vlq(buffer, event->midi_buffer_length);
 	if (ret)
 		return (ret);
 
-	ret = track_append(event->track, event->midi_buffer, event->midi_buffer_length);
+	ret = buffer_append(buffer, event->midi_buffer, event->midi_buffer_length);
 	if (ret)
 		return (ret);
 
@@ -308,27 +274,27 @@ write_escaped_event_contents(smf_event_t *event)
  * different value in case of error.
  */
 static int
-write_event_contents(smf_event_t *event)
+write_event_contents(struct save_buffer_struct *buffer, const smf_event_t *event)
 {
 	if (smf_event_is_system_realtime(event) || smf_event_is_system_common(event))
-		return (write_escaped_event_contents(event));
+		return (write_escaped_event_contents(buffer, event));
 
-	return (track_append(event->track, event->midi_buffer, event->midi_buffer_length));
+	return (buffer_append(buffer, event->midi_buffer, event->midi_buffer_length));
 }
 
 /**
  * Writes out an event.
  */
 static int
-write_event(smf_event_t *event)
+write_event(struct save_buffer_struct *buffer, const smf_event_t *event)
 {
 	int ret;
 
-	ret = write_event_time(event);
+	ret = write_event_time(buffer, event);
 	if (ret)
 		return (ret);
 
-	ret = write_event_contents(event);
+	ret = write_event_contents(buffer, event);
 	if (ret)
 		return (ret);
 
@@ -336,66 +302,56 @@ write_event(smf_event_t *event)
 }
 
 /**
- * Writes out MTrk header, except of MTrk chunk length, which is written by write_mtrk_length().
+ * Writes out the track: MTrk header, the events in order, and End Of Track, if the track does not
+ * have one already.  Only reads the track; delta times are taken from the events as they are.
  */
 static int
-write_mtrk_header(smf_track_t *track)
+write_track(struct save_buffer_struct *buffer, const smf_track_t *track)
 {
-	struct chunk_header_struct mtrk_header;
+	int ret, i, mtrk_offset, eot_found = 0;
+	struct chunk_header_struct mtrk_header, *mtrk;
+	const smf_event_t *event;
+	/* Delta time of zero, followed by End Of Track metaevent. */
+	static const unsigned char eot[] = {0x00, 0xFF, 0x2F, 0x00};
 
 	memcpy(mtrk_header.id, "MTrk", 4);
+	mtrk_header.length = 0;
 
-	return (track_append(track, &mtrk_header, sizeof(mtrk_header)));
-}
-
-/**
- * Updates MTrk chunk length of a given track.
- */
-static int
-write_mtrk_length(smf_track_t *track)
-{
-	struct chunk_header_struct *mtrk_header;
-
-	assert(track->file_buffer != NULL);
-	assert(track->file_buffer_length >= 6);
+	mtrk_offset = buffer->length;
+	ret = buffer_append(buffer, &mtrk_header, sizeof(mtrk_header));
+	if (ret)
+		return (ret);
 
-	mtrk_header = (struct chunk_header_struct *)track->file_buffer;
-	mtrk_header->length = htonl(track->file_buffer_length - sizeof(struct chunk_header_struct));
+	/* Not event->track; events shared with a frozen smf belong to it, see smf_clone_shared(). */
+	for (i = 0; i < track->events_array->len; i++) {
+		event = g_ptr_array_index(track->events_array, i);
 
-	return (0);
-}
-
-/**
- * Writes out the track.
- */
-static int
-write_track(smf_track_t *track)
-{
-	int ret;
-	smf_event_t *event;
+		ret = write_event(buffer, event);
+		if (ret)
+			return (ret);
 
-	ret = write_mtrk_header(track);
-	if (ret)
-		return (ret);
+		if (smf_event_is_eot(event))
+			eot_found = 1;
+	}
 
-	while ((event = smf_track_get_next_event(track)) != NULL) {
-		ret = write_event(event);
+	if (!eot_found) {
+		ret = buffer_append(buffer, eot, sizeof(eot));
 		if (ret)
 			return (ret);
 	}
 
-	ret = write_mtrk_length(track);
-	if (ret)
-		return (ret);
+	/* Buffer might have been reallocated since the header was written. */
+	mtrk = (struct chunk_header_struct *)(buffer->data + mtrk_offset);
+	mtrk->length = htonl(buffer->length - mtrk_offset - sizeof(struct chunk_header_struct));
 
 	return (0);
 }
 
 /**
- * Takes smf->file_buffer and saves it to the file.
+ * Saves contents of the buffer to the file.
  */
 static int
-write_file(smf_t *smf, const char *file_name)
+write_file(const struct save_buffer_struct *buffer, const char *file_name)
 {
 	FILE *stream;
 
@@ -406,7 +362,7 @@ write_file(smf_t *smf, const char *file_name)
 		return (-1);
 	}
 
-	if (fwrite(smf->file_buffer, 1, smf->file_buffer_length, stream) != smf->file_buffer_length) {
+	if (fwrite(buffer->data, 1, buffer->length, stream) != buffer->length) {
 		g_critical("fwrite(3) failed: %s", strerror(errno));
 
 		return (-2);
@@ -421,53 +377,6 @@ write_file(smf_t *smf, const char *file_name)
 	return (0);
 }
 
-static void
-free_buffer(smf_t *smf)
-{
-	int i;
-	smf_track_t *track;
-
-	/* Clear the pointers. */
-	memset(smf->file_buffer, 0, smf->file_buffer_length);
-	free(smf->file_buffer);
-	smf->file_buffer = NULL;
-	smf->file_buffer_length = 0;
-
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		track = smf_get_track_by_number(smf, i);
-		assert(track);
-		track->file_buffer = NULL;
-		track->file_buffer_length = 0;
-	}
-}
-
-#ifndef NDEBUG
-
-/**
- * \return Nonzero, if all pointers supposed to be NULL are NULL.  Triggers assertion if not.
- */
-static int
-pointers_are_clear(smf_t *smf)
-{
-	int i;
-
-	smf_track_t *track;
-	assert(smf->file_buffer == NULL);
-	assert(smf->file_buffer_length == 0);
-
-	for (i = 1; i <= smf->number_of_tracks; i++) {
-		track = smf_get_track_by_number(smf, i);
-
-		assert(track != NULL);
-		assert(track->file_buffer == NULL);
-		assert(track->file_buffer_length == 0);
-	}
-
-	return (1);
-}
-
-#endif /* !NDEBUG */
-
 /**
  * \return Nonzero, if event is End Of Track metaevent.
  */
@@ -484,16 +393,17 @@ smf_event_is_eot(const smf_event_t *event)
 }
 
 /**
- * Check if SMF is valid and add missing EOT events.
+ * Check if SMF is valid.  Missing EOT events are not added here; write_track() writes them.
+ * Like smf_get_track_by_number(), parses tracks loaded lazily and brings event numbers up to date.
  *
  * \return 0, if SMF is valid.
  */
 static int
 smf_validate(smf_t *smf)
 {
-	int trackno, eventno, eot_found;
-	smf_track_t *track;
-	smf_event_t *event;
+	int trackno, i, eot_found;
+	const smf_track_t *track;
+	const smf_event_t *event;
 
 	if (smf->format < 0 || smf->format > 2) {
 		g_critical("SMF error: smf->format is less than zero of greater than two.");
@@ -521,12 +431,12 @@ smf_validate(smf_t *smf)
 
 		eot_found = 0;
 
-		for (eventno = 1; eventno <= track->number_of_events; eventno++) {
-			event = smf_track_get_event_by_number(track, eventno);
+		for (i = 0; i < track->events_array->len; i++) {
+			event = g_ptr_array_index(track->events_array, i);
 			assert(event);
 
 			if (!smf_event_is_valid(event)) {
-				g_critical("Event #%d on track #%d is invalid.", eventno, trackno);
+				g_critical("Event #%d on track #%d is invalid.", i + 1, trackno);
 				return (-5);
 			}
 
@@ -539,14 +449,6 @@ smf_validate(smf_t *smf)
 				eot_found = 1;
 			}
 		}
-
-		if (!eot_found) {
-			if (smf_track_add_eot_delta_pulses(track, 0)) {
-				g_critical("smf_track_add_eot_delta_pulses failed.");
-				return (-6);
-			}
-		}
-				
 	}
 
 	return (0);
@@ -554,32 +456,39 @@ smf_validate(smf_t *smf)
 
 #ifndef NDEBUG
 
+/*
+ * Event and track numbers of events in "a" might be stale - saving does not bring them up to date,
+ * and events shared with a frozen smf carry its numbers - so position and track are compared instead.
+ */
 static void
-assert_smf_event_is_identical(const smf_event_t *a, const smf_event_t *b)
+assert_smf_event_is_identical(const smf_t *smf, const smf_event_t *a, const smf_event_t *b)
 {
-	assert(a->event_number == b->event_number);
+	assert(smf_event_index(a) == b->event_number - 1);
+	assert(smf_track_of_event(smf, a)->track_number == b->track_number);
 	assert(a->delta_time_pulses == b->delta_time_pulses);
 	assert(abs(a->time_pulses - b->time_pulses) <= 2);
 	assert(fabs(a->time_seconds - b->time_seconds) <= 0.01);
-	assert(a->track_number == b->track_number);
 	assert(a->midi_buffer_length == b->midi_buffer_length);
 	assert(memcmp(a->midi_buffer, b->midi_buffer, a->midi_buffer_length) == 0);
 }
 
 static void
-assert_smf_track_is_identical(const smf_track_t *a, const smf_track_t *b)
+assert_smf_track_is_identical(const smf_t *smf, const smf_track_t *a, const smf_track_t *b)
 {
 	int i;
 
 	assert(a->track_number == b->track_number);
-	assert(a->number_of_events == b->number_of_events);
 
-	for (i = 1; i <= a->number_of_events; i++)
-		assert_smf_event_is_identical(smf_track_get_event_by_number(a, i), smf_track_get_event_by_number(b, i));
+	/* End Of Track gets written, if the track did not have one. */
+	assert(a->number_of_events == b->number_of_events || (a->number_of_events + 1 == b->number_of_events &&
+		smf_event_is_eot(g_ptr_array_index(b->events_array, b->number_of_events - 1))));
+
+	for (i = 0; i < a->number_of_events; i++)
+		assert_smf_event_is_identical(smf, g_ptr_array_index(a->events_array, i), g_ptr_array_index(b->events_array, i));
 }
 
 static void
-assert_smf_is_identical(const smf_t *a, const smf_t *b)
+assert_smf_is_identical(smf_t *a, smf_t *b)
 {
 	int i;
 
@@ -590,13 +499,13 @@ assert_smf_is_identical(const smf_t *a, const smf_t *b)
 	assert(a->number_of_tracks == b->number_of_tracks);
 
 	for (i = 1; i <= a->number_of_tracks; i++)
-		assert_smf_track_is_identical(smf_get_track_by_number(a, i), smf_get_track_by_number(b, i));
+		assert_smf_track_is_identical(a, smf_get_track_by_number(a, i), smf_get_track_by_number(b, i));
 
 	/* We do not need to compare tempos explicitly, as tempo is always computed from track contents. */
 }
 
 static void
-assert_smf_saved_correctly(const smf_t *smf, const char *file_name)
+assert_smf_saved_correctly(smf_t *smf, const char *file_name)
 {
 	smf_t *saved;
 
@@ -611,7 +520,11 @@ assert_smf_saved_correctly(const smf_t *smf, const char *file_name)
 #endif /* !NDEBUG */
 
 /**
-  * Writes the contents of SMF to the file given.
+  * Writes the contents of SMF to the file given.  The contents of the smf are not modified, so frozen smfs
+  * can be saved too, and the position of smf_get_next_event() stays where it was.  Tracks that do not
+  * have an End Of Track event get one in the file, but not in the smf.  Like smf_get_track_by_number(),
+  * this parses tracks loaded lazily and brings event numbers up to date; frozen smfs have nothing to
+  * parse or renumber, so several threads may save the same frozen smf at once.
   * \param smf SMF.
   * \param file_name Path to the file.
   * \return 0, if saving was successfull.
@@ -621,32 +534,33 @@ smf_save(smf_t *smf, const char *file_name)
 {
 	int i, error;
 	smf_track_t *track;
-
-	smf_rewind(smf);
-
-	assert(pointers_are_clear(smf));
+	struct save_buffer_struct buffer;
 
 	if (smf_validate(smf))
 		return (-1);
 
-	if (write_mthd_header(smf))
+	memset(&buffer, 0, sizeof(buffer));
+
+	if (write_mthd_header(&buffer, smf)) {
+		free(buffer.data);
 		return (-2);
+	}
 
 	for (i = 1; i <= smf->number_of_tracks; i++) {
 		track = smf_get_track_by_number(smf, i);
 
 		assert(track != NULL);
 
-		error = write_track(track);
+		error = write_track(&buffer, track);
 		if (error) {
-			free_buffer(smf);
+			free(buffer.data);
 			return (error);
 		}
 	}
 
-	error = write_file(smf, file_name);
+	error = write_file(&buffer, file_name);
 
-	free_buffer(smf);
+	free(buffer.data);
 
 	if (error)
 		return (error);
@@ -657,4 +571,3 @@ smf_save(smf_t *smf, const char *file_name)
 
 	return (0);
 }
-
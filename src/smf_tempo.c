@@ -39,7 +39,31 @@
 #include "smf.h"
 #include "smf_private.h"
 
-static double seconds_from_pulses(const smf_t *smf, int pulses);
+/**
+ * Computes time, in seconds, of the event happening at "pulses", given the last "tempo" before it.
+ */
+static double
+seconds_from_tempo(const smf_t *smf, const smf_tempo_t *tempo, int pulses)
+{
+	assert(tempo->time_pulses <= pulses);
+
+	return (tempo->time_seconds + (double)(pulses - tempo->time_pulses) *
+		(tempo->microseconds_per_quarter_note / ((double)smf->ppqn * 1000000.0)));
+}
+
+/**
+ * Computes time, in seconds, of the event happening at "pulses", using current tempo map.
+ */
+static double
+seconds_from_pulses(const smf_t *smf, int pulses)
+{
+	smf_tempo_t *tempo;
+
+	tempo = smf_get_tempo_by_pulses(smf, pulses);
+	assert(tempo);
+
+	return (seconds_from_tempo(smf, tempo, pulses));
+}
 
 /**
  * If there is tempo starting at "pulses" already, return it.  Otherwise,
@@ -120,48 +144,64 @@ add_time_signature(smf_t *smf, int pulses, int numerator, int denominator, int c
 
 /**
  * \internal
+ *
+ * Adds tempo change or time signature contained in "midi_buffer", happening at "pulses",
+ * to the tempo map.  Does nothing if the message is neither.  Tempo map entries need
+ * to be added in time order.
  */
 void
-maybe_add_to_tempo_map(smf_event_t *event)
+maybe_add_message_to_tempo_map(smf_t *smf, int pulses, const unsigned char *midi_buffer, int midi_buffer_length)
 {
-	if (!smf_event_is_metadata(event))
-		return;
+	assert(midi_buffer_length >= 1);
 
-	assert(event->track != NULL);
-	assert(event->track->smf != NULL);
-	assert(event->midi_buffer_length >= 1);
+	if (midi_buffer[0] != 0xFF)
+		return;
 
 	/* Tempo Change? */
-	if (event->midi_buffer[1] == 0x51) {
-		int new_tempo = (event->midi_buffer[3] << 16) + (event->midi_buffer[4] << 8) + event->midi_buffer[5];
+	if (midi_buffer[1] == 0x51) {
+		int new_tempo = (midi_buffer[3] << 16) + (midi_buffer[4] << 8) + midi_buffer[5];
 		if (new_tempo <= 0) {
 			g_critical("Ignoring invalid tempo change.");
 			return;
 		}
 
-		add_tempo(event->track->smf, event->time_pulses, new_tempo);
+		add_tempo(smf, pulses, new_tempo);
 	}
 
 	/* Time Signature? */
-	if (event->midi_buffer[1] == 0x58) {
+	if (midi_buffer[1] == 0x58) {
 		int numerator, denominator, clocks_per_click, notes_per_note;
 
-		if (event->midi_buffer_length < 7) {
+		if (midi_buffer_length < 7) {
 			g_critical("Time Signature event seems truncated.");
 			return;
 		}
 
-		numerator = event->midi_buffer[3];
-		denominator = (int)pow(2, event->midi_buffer[4]);
-		clocks_per_click = event->midi_buffer[5];
-		notes_per_note = event->midi_buffer[6];
+		numerator = midi_buffer[3];
+		denominator = (int)pow(2, midi_buffer[4]);
+		clocks_per_click = midi_buffer[5];
+		notes_per_note = midi_buffer[6];
 
-		add_time_signature(event->track->smf, event->time_pulses, numerator, denominator, clocks_per_click, notes_per_note);
+		add_time_signature(smf, pulses, numerator, denominator, clocks_per_click, notes_per_note);
 	}
 
 	return;
 }
 
+/**
+ * \internal
+ */
+void
+maybe_add_to_tempo_map(smf_t *smf, const smf_event_t *event)
+{
+	if (!smf_event_is_metadata(event))
+		return;
+
+	assert(event->midi_buffer_length >= 1);
+
+	maybe_add_message_to_tempo_map(smf, event->time_pulses, event->midi_buffer, event->midi_buffer_length);
+}
+
 /**
  * \internal
  *
@@ -193,22 +233,6 @@ remove_last_tempo_with_pulses(smf_t *smf, int pulses)
 	g_ptr_array_remove_index(smf->tempo_array, smf->tempo_array->len - 1);
 }
 
-static double
-seconds_from_pulses(const smf_t *smf, int pulses)
-{
-	double seconds;
-	smf_tempo_t *tempo;
-
-	tempo = smf_get_tempo_by_pulses(smf, pulses);
-	assert(tempo);
-	assert(tempo->time_pulses <= pulses);
-
-	seconds = tempo->time_seconds + (double)(pulses - tempo->time_pulses) *
-		(tempo->microseconds_per_quarter_note / ((double)smf->ppqn * 1000000.0));
-
-	return (seconds);
-}
-
 static int
 pulses_from_seconds(const smf_t *smf, double seconds)
 {
@@ -228,29 +252,122 @@ pulses_from_seconds(const smf_t *smf, double seconds)
 /**
  * \internal
  *
- * Computes value of event->time_seconds for all events in smf.
+ * Computes value of event->time_seconds for all events in the track, using current tempo map.
+ * Events are sorted by time, so instead of looking up the tempo for every one of them,
+ * we just move forward through the tempo map.
+ */
+void
+smf_track_compute_seconds(smf_track_t *track)
+{
+	int i, tempo_number = 0;
+	double seconds;
+	smf_t *smf = track->smf;
+	smf_event_t *event;
+	smf_tempo_t *tempo, *next_tempo;
+
+	assert(smf != NULL);
+	assert(smf->tempo_array->len > 0);
+
+	smf_track_renumber_events(track);
+
+	tempo = smf_get_tempo_by_number(smf, 0);
+	next_tempo = smf_get_tempo_by_number(smf, 1);
+
+	for (i = 0; i < track->events_array->len; i++) {
+		event = g_ptr_array_index(track->events_array, i);
+
+		/* Same as smf_get_tempo_by_pulses(): last tempo that starts before the event. */
+		while (next_tempo != NULL && next_tempo->time_pulses < event->time_pulses) {
+			tempo = next_tempo;
+			tempo_number++;
+			next_tempo = smf_get_tempo_by_number(smf, tempo_number + 1);
+		}
+
+		seconds = seconds_from_tempo(smf, tempo, event->time_pulses);
+		if (event->time_seconds == seconds)
+			continue;
+
+		/* Tracks shared with a frozen smf get copied only if their events actually move. */
+		if (track->shared_track != NULL) {
+			if (smf_track_unshare(track))
+				return;
+
+			event = g_ptr_array_index(track->events_array, i);
+		}
+
+		event->time_seconds = seconds;
+	}
+
+	smf_track_update_length(track);
+}
+
+/**
+ * Used to sort tempo-related events in the order smf_get_next_event() would return them.
+ * Events at the same time are left in the order they were collected - by track, then by
+ * event number - as g_ptr_array_sort() is stable.  Comparing event->track->track_number
+ * instead would not work for tracks shared with a frozen smf; see smf_clone_shared().
+ */
+static gint
+tempo_events_compare_function(gconstpointer aa, gconstpointer bb)
+{
+	const smf_event_t *a, *b;
+
+	a = *(const smf_event_t **)aa;
+	b = *(const smf_event_t **)bb;
+
+	if (a->time_pulses != b->time_pulses)
+		return (a->time_pulses < b->time_pulses ? -1 : 1);
+
+	return (0);
+}
+
+/**
+ * \internal
+ *
+ * Creates tempo map from Tempo Change and Time Signature events and computes value
+ * of event->time_seconds for all events in smf.  Time it takes is linear in the number
+ * of events, apart from sorting the tempo-related ones.
  * Warning: rewinds the smf.
  */
 void
 smf_create_tempo_map_and_compute_seconds(smf_t *smf)
 {
+	int i, j;
+	smf_track_t *track;
 	smf_event_t *event;
+	GPtrArray *tempo_events;
 
+	/* This also parses any tracks that were loaded lazily. */
 	smf_rewind(smf);
 	smf_init_tempo(smf);
 
-	for (;;) {
-		event = smf_get_next_event(smf);
-		
-		if (event == NULL)
-			return;
+	/* Times of all the events may change; the heap gets built again at the end. */
+	smf->length_heap_is_valid = 0;
+
+	tempo_events = g_ptr_array_new();
 
-		maybe_add_to_tempo_map(event);
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
 
-		event->time_seconds = seconds_from_pulses(smf, event->time_pulses);
+		for (j = 0; j < track->events_array->len; j++) {
+			event = g_ptr_array_index(track->events_array, j);
+
+			if (smf_event_is_tempo_change_or_time_signature(event))
+				g_ptr_array_add(tempo_events, event);
+		}
 	}
 
-	/* Not reached. */
+	g_ptr_array_sort(tempo_events, tempo_events_compare_function);
+
+	for (i = 0; i < tempo_events->len; i++)
+		maybe_add_to_tempo_map(smf, g_ptr_array_index(tempo_events, i));
+
+	g_ptr_array_free(tempo_events, TRUE);
+
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		smf_track_compute_seconds(smf_get_track_by_number(smf, i));
+
+	smf_build_length_heap(smf);
 }
 
 smf_tempo_t *
@@ -356,6 +473,34 @@ smf_fini_tempo(smf_t *smf)
 	assert(smf->tempo_array->len == 0);
 }
 
+/**
+ * \internal
+ *
+ * Replaces the tempo map of "smf" with a copy of the one of "source", without recomputing anything.
+ * \return 0 if everything went ok, nonzero otherwise.
+ */
+int
+smf_copy_tempo_map(smf_t *smf, const smf_t *source)
+{
+	int i;
+	smf_tempo_t *tempo;
+
+	smf_fini_tempo(smf);
+
+	for (i = 0; i < source->tempo_array->len; i++) {
+		tempo = malloc(sizeof(smf_tempo_t));
+		if (tempo == NULL) {
+			g_critical("Cannot allocate smf_tempo_t.");
+			return (-1);
+		}
+
+		*tempo = *(smf_tempo_t *)g_ptr_array_index(source->tempo_array, i);
+		g_ptr_array_add(smf->tempo_array, tempo);
+	}
+
+	return (0);
+}
+
 /**
  * \internal
  *
@@ -379,7 +524,7 @@ smf_init_tempo(smf_t *smf)
  * Returns ->time_pulses of last event on the given track, or 0, if track is empty.
  */
 static int
-last_event_pulses(const smf_track_t *track)
+last_event_pulses(smf_track_t *track)
 {
 	/* Get time of last event on this track. */
 	if (track->number_of_events > 0) {
@@ -423,6 +568,9 @@ smf_track_add_event_pulses(smf_track_t *track, smf_event_t *event, int pulses)
 	assert(event->time_seconds == -1.0);
 	assert(track->smf != NULL);
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_event_pulses"))
+		return;
+
 	event->time_pulses = pulses;
 	event->time_seconds = seconds_from_pulses(track->smf, pulses);
 	smf_track_add_event(track, event);
@@ -441,6 +589,9 @@ smf_track_add_event_seconds(smf_track_t *track, smf_event_t *event, double secon
 	assert(event->time_seconds == -1.0);
 	assert(track->smf != NULL);
 
+	if (smf_refuse_if_frozen(track->smf, "smf_track_add_event_seconds"))
+		return;
+
 	event->time_seconds = seconds;
 	event->time_pulses = pulses_from_seconds(track->smf, seconds);
 	smf_track_add_event(track, event);
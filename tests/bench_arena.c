@@ -0,0 +1,275 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Benchmark for the arena allocator used by the loader.  Loads a synthetic song from memory,
+ * counts calls to malloc(3) made for its events, and compares allocating the same events
+ * from an arena with allocating them one by one, like smf_event_new_from_pointer() does.
+ *
+ * Usage: bench_arena
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define REPETITIONS		20
+#define NUMBER_OF_TRACKS	16
+#define EVENTS_PER_TRACK	50000
+#define SYNTHETIC_FILE_NAME	"bench_arena.mid"
+
+static double
+now_ms(void)
+{
+	return (g_get_monotonic_time() / 1000.0);
+}
+
+/*
+ * Makes SMF file in memory: mostly Note On and Note Off, with some text metaevents, long enough
+ * not to fit into smf_event_t.
+ */
+static void *
+make_synthetic_song(int *length)
+{
+	int i, j;
+	char text[32];
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event;
+	FILE *stream;
+	void *buffer;
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (NULL);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (NULL);
+
+		smf_add_track(smf, track);
+
+		for (j = 0; j < EVENTS_PER_TRACK; j++) {
+			if (j % 100 == 0) {
+				snprintf(text, sizeof(text), "Marker %d", j);
+				event = smf_event_new_textual(0x06, text);
+			} else {
+				event = smf_event_new_from_bytes(0x90 | i, j % 128, j % 2 ? 0 : 100);
+			}
+
+			if (event == NULL)
+				return (NULL);
+
+			smf_track_add_event_delta_pulses(track, event, rand() % 48);
+		}
+	}
+
+	/* There is no way to save into memory, so go through a file. */
+	if (smf_save(smf, SYNTHETIC_FILE_NAME))
+		return (NULL);
+
+	smf_delete(smf);
+
+	stream = fopen(SYNTHETIC_FILE_NAME, "rb");
+	if (stream == NULL)
+		return (NULL);
+
+	fseek(stream, 0, SEEK_END);
+	*length = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+
+	buffer = malloc(*length);
+	if (buffer == NULL || fread(buffer, 1, *length, stream) != (size_t)*length) {
+		fclose(stream);
+		return (NULL);
+	}
+
+	fclose(stream);
+	remove(SYNTHETIC_FILE_NAME);
+
+	return (buffer);
+}
+
+static void
+benchmark_load(const void *buffer, int length)
+{
+	int i;
+	double start, elapsed, best_load = 0.0, total_load = 0.0, best_delete = 0.0, total_delete = 0.0;
+	smf_t *smf;
+
+	for (i = 0; i < REPETITIONS; i++) {
+		start = now_ms();
+		smf = smf_load_from_memory(buffer, length);
+		elapsed = now_ms() - start;
+
+		if (smf == NULL) {
+			fprintf(stderr, "Cannot load the song.\n");
+			exit(1);
+		}
+
+		if (i == 0 || elapsed < best_load)
+			best_load = elapsed;
+		total_load += elapsed;
+
+		start = now_ms();
+		smf_delete(smf);
+		elapsed = now_ms() - start;
+
+		if (i == 0 || elapsed < best_delete)
+			best_delete = elapsed;
+		total_delete += elapsed;
+	}
+
+	printf("smf_load_from_memory(): best %8.3f ms, mean %8.3f ms\n", best_load, total_load / REPETITIONS);
+	printf("smf_delete():           best %8.3f ms, mean %8.3f ms\n", best_delete, total_delete / REPETITIONS);
+}
+
+static void
+count_allocations(smf_t *smf)
+{
+	int i, j, number_of_events = 0, with_arena = 0, without_arena = 0;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
+
+		/* The arena itself and its blocks. */
+		if (track->arena != NULL)
+			with_arena += 1 + smf_arena_number_of_blocks(track->arena);
+
+		for (j = 1; j <= track->number_of_events; j++) {
+			event = smf_track_get_event_by_number(track, j);
+
+			/* One for smf_event_t, another one for MIDI data that does not fit into it. */
+			without_arena += event->midi_buffer_length <= SMF_INLINE_BUFFER_LENGTH ? 1 : 2;
+			number_of_events++;
+		}
+	}
+
+	printf("%d events in %d tracks: %d malloc(3) calls with arena, %d without\n",
+		number_of_events, smf->number_of_tracks, with_arena, without_arena);
+}
+
+/*
+ * Copies every event of the song, first using smf_event_new_from_pointer(), then from an arena,
+ * and frees the copies.
+ */
+static void
+benchmark_allocation(smf_t *smf)
+{
+	int i, j, k, number_of_events = 0;
+	double start, elapsed[2] = {0.0, 0.0};
+	smf_track_t *track;
+	smf_event_t *event, **copies;
+	smf_arena_t *arena;
+
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		number_of_events += smf_get_track_by_number(smf, i)->number_of_events;
+
+	copies = malloc(number_of_events * sizeof(smf_event_t *));
+	if (copies == NULL)
+		exit(1);
+
+	for (k = 0; k < REPETITIONS; k++) {
+		start = now_ms();
+
+		for (i = 1, number_of_events = 0; i <= smf->number_of_tracks; i++) {
+			track = smf_get_track_by_number(smf, i);
+
+			for (j = 1; j <= track->number_of_events; j++) {
+				event = smf_track_get_event_by_number(track, j);
+				copies[number_of_events++] = smf_event_new_from_pointer(event->midi_buffer, event->midi_buffer_length);
+			}
+		}
+
+		for (i = 0; i < number_of_events; i++)
+			smf_event_delete(copies[i]);
+
+		elapsed[0] += now_ms() - start;
+		start = now_ms();
+
+		for (i = 1, number_of_events = 0; i <= smf->number_of_tracks; i++) {
+			track = smf_get_track_by_number(smf, i);
+			arena = smf_arena_new();
+
+			for (j = 1; j <= track->number_of_events; j++) {
+				event = smf_track_get_event_by_number(track, j);
+				copies[number_of_events] = smf_event_new_from_arena(arena, event->midi_buffer_length);
+				memcpy(copies[number_of_events]->midi_buffer, event->midi_buffer, event->midi_buffer_length);
+				number_of_events++;
+			}
+
+			smf_arena_unref(arena);
+		}
+
+		for (i = 0; i < number_of_events; i++)
+			smf_event_delete(copies[i]);
+
+		elapsed[1] += now_ms() - start;
+	}
+
+	free(copies);
+
+	printf("Allocating and freeing %d events: %8.3f ms one by one, %8.3f ms from arenas\n",
+		number_of_events, elapsed[0] / REPETITIONS, elapsed[1] / REPETITIONS);
+}
+
+int
+main(void)
+{
+	int length;
+	void *buffer;
+	smf_t *smf;
+
+	srand(4);
+
+	buffer = make_synthetic_song(&length);
+	if (buffer == NULL) {
+		fprintf(stderr, "Cannot make the song.\n");
+		return (1);
+	}
+
+	benchmark_load(buffer, length);
+
+	smf = smf_load_from_memory(buffer, length);
+	if (smf == NULL)
+		return (1);
+
+	count_allocations(smf);
+	benchmark_allocation(smf);
+
+	smf_delete(smf);
+	free(buffer);
+
+	return (0);
+}
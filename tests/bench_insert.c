@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Benchmark for smf_track_add_event_pulses() with events inserted at random positions in the
+ * track, compared with events appended in order and inserted at the very beginning.
+ *
+ * Usage: bench_insert
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+
+#define MIN_EVENTS	1000
+#define MAX_EVENTS	64000
+
+static double
+now_ms(void)
+{
+	return (g_get_monotonic_time() / 1000.0);
+}
+
+/*
+ * Adds "number_of_events" events at "pulses" to a new track.
+ * \return Time it took, in microseconds per event.
+ */
+static double
+insert_events(const int *pulses, int number_of_events)
+{
+	int i;
+	double start, elapsed;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	smf = smf_new();
+	track = smf_track_new();
+	if (smf == NULL || track == NULL)
+		exit(1);
+
+	smf_add_track(smf, track);
+
+	start = now_ms();
+
+	for (i = 0; i < number_of_events; i++) {
+		event = smf_event_new_from_bytes(0x90, i % 128, 100);
+		if (event == NULL)
+			exit(1);
+
+		smf_track_add_event_pulses(track, event, pulses[i]);
+	}
+
+	elapsed = now_ms() - start;
+
+	smf_delete(smf);
+
+	return (elapsed * 1000.0 / number_of_events);
+}
+
+int
+main(void)
+{
+	int i, number_of_events, *ascending, *random, *descending;
+
+	ascending = malloc(MAX_EVENTS * sizeof(int));
+	random = malloc(MAX_EVENTS * sizeof(int));
+	descending = malloc(MAX_EVENTS * sizeof(int));
+	if (ascending == NULL || random == NULL || descending == NULL)
+		return (1);
+
+	srand(12);
+
+	printf("%10s %14s %14s %14s\n", "events", "append, us", "random, us", "front, us");
+
+	for (number_of_events = MIN_EVENTS; number_of_events <= MAX_EVENTS; number_of_events *= 2) {
+		for (i = 0; i < number_of_events; i++) {
+			ascending[i] = i;
+			random[i] = rand() % number_of_events;
+			descending[i] = number_of_events - i;
+		}
+
+		printf("%10d %14.3f %14.3f %14.3f\n", number_of_events, insert_events(ascending, number_of_events),
+			insert_events(random, number_of_events), insert_events(descending, number_of_events));
+	}
+
+	free(ascending);
+	free(random);
+	free(descending);
+
+	return (0);
+}
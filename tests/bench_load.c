@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Benchmark for smf_load(), which maps the file into memory, against reading the whole file
+ * into a buffer first and parsing it with smf_load_from_memory(), which is what smf_load() did
+ * before.  Without arguments, it writes a synthetic song into "bench_load.mid" and uses that.
+ *
+ * Usage: bench_load [file.mid ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+
+#define REPETITIONS		20
+#define NUMBER_OF_TRACKS	16
+#define EVENTS_PER_TRACK	50000
+#define SYNTHETIC_FILE_NAME	"bench_load.mid"
+
+static double
+now_ms(void)
+{
+	return (g_get_monotonic_time() / 1000.0);
+}
+
+static int
+write_synthetic_song(const char *file_name)
+{
+	int i, j;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (-1);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (-1);
+
+		smf_add_track(smf, track);
+
+		for (j = 0; j < EVENTS_PER_TRACK; j++) {
+			event = smf_event_new_from_bytes(0x90 | i, j % 128, j % 2 ? 0 : 100);
+			if (event == NULL)
+				return (-1);
+
+			smf_track_add_event_delta_pulses(track, event, rand() % 48);
+		}
+	}
+
+	if (smf_save(smf, file_name))
+		return (-1);
+
+	smf_delete(smf);
+
+	return (0);
+}
+
+/*
+ * Loads the file the way smf_load() did without mmap(2): reads it into allocated buffer first.
+ */
+static smf_t *
+load_by_reading(const char *file_name)
+{
+	FILE *stream;
+	long length;
+	void *buffer;
+	smf_t *smf;
+
+	stream = fopen(file_name, "rb");
+	if (stream == NULL)
+		return (NULL);
+
+	if (fseek(stream, 0, SEEK_END) || (length = ftell(stream)) <= 0 || fseek(stream, 0, SEEK_SET)) {
+		fclose(stream);
+		return (NULL);
+	}
+
+	buffer = malloc(length);
+	if (buffer == NULL || fread(buffer, 1, length, stream) != (size_t)length) {
+		free(buffer);
+		fclose(stream);
+		return (NULL);
+	}
+
+	fclose(stream);
+
+	smf = smf_load_from_memory(buffer, length);
+	free(buffer);
+
+	return (smf);
+}
+
+static void
+benchmark_file(const char *file_name)
+{
+	int i, j, method, number_of_events = 0;
+	double start, elapsed, best[2] = {0.0, 0.0}, total[2] = {0.0, 0.0};
+	smf_t *smf;
+
+	for (i = 0; i < REPETITIONS; i++) {
+		/* Alternate, so that both methods see the page cache in the same state. */
+		for (method = 0; method < 2; method++) {
+			start = now_ms();
+
+			if (method == 0)
+				smf = smf_load(file_name);
+			else
+				smf = load_by_reading(file_name);
+
+			elapsed = now_ms() - start;
+
+			if (smf == NULL) {
+				fprintf(stderr, "Cannot load '%s'.\n", file_name);
+				return;
+			}
+
+			for (j = 1, number_of_events = 0; j <= smf->number_of_tracks; j++)
+				number_of_events += smf_get_track_by_number(smf, j)->number_of_events;
+
+			smf_delete(smf);
+
+			if (i == 0 || elapsed < best[method])
+				best[method] = elapsed;
+			total[method] += elapsed;
+		}
+	}
+
+	printf("%s: %d events\n", file_name, number_of_events);
+	printf("  smf_load():                    best %8.3f ms, mean %8.3f ms\n", best[0], total[0] / REPETITIONS);
+	printf("  read + smf_load_from_memory(): best %8.3f ms, mean %8.3f ms\n", best[1], total[1] / REPETITIONS);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			benchmark_file(argv[i]);
+
+		return (0);
+	}
+
+	srand(1);
+
+	if (write_synthetic_song(SYNTHETIC_FILE_NAME)) {
+		fprintf(stderr, "Cannot write '%s'.\n", SYNTHETIC_FILE_NAME);
+		return (1);
+	}
+
+	benchmark_file(SYNTHETIC_FILE_NAME);
+	remove(SYNTHETIC_FILE_NAME);
+
+	return (0);
+}
@@ -0,0 +1,170 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Benchmark for merging tracks during playback: plays a song with the same number of events spread
+ * over 1 to 256 tracks using smf_get_next_event(), and, for comparison, by scanning all the tracks
+ * for the earliest event every time, which is what smf_get_next_event() did before.
+ *
+ * Usage: bench_merge
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+
+#define REPETITIONS		10
+#define NUMBER_OF_EVENTS	262144
+#define MAX_TRACKS		256
+#define MAX_PULSES		1000000
+
+static double
+now_ms(void)
+{
+	return (g_get_monotonic_time() / 1000.0);
+}
+
+static smf_t *
+make_song(int number_of_tracks)
+{
+	int i, j, events_per_track = NUMBER_OF_EVENTS / number_of_tracks, *pulses;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t **events;
+
+	smf = smf_new();
+	events = malloc(events_per_track * sizeof(smf_event_t *));
+	pulses = malloc(events_per_track * sizeof(int));
+	if (smf == NULL || events == NULL || pulses == NULL)
+		exit(1);
+
+	for (i = 0; i < number_of_tracks; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			exit(1);
+
+		smf_add_track(smf, track);
+
+		for (j = 0; j < events_per_track; j++) {
+			events[j] = smf_event_new_from_bytes(0x90 | (i % 16), j % 128, 100);
+			if (events[j] == NULL)
+				exit(1);
+
+			pulses[j] = rand() % MAX_PULSES;
+		}
+
+		smf_track_add_events(track, events, pulses, events_per_track);
+	}
+
+	free(events);
+	free(pulses);
+
+	return (smf);
+}
+
+/*
+ * Goes through the song by looking at the next event of every track and taking the earliest one.
+ * \return Number of events.
+ */
+static int
+play_by_scanning(smf_t *smf, int *next_event_numbers)
+{
+	int i, count = 0;
+	smf_track_t *track, *min_track;
+	smf_event_t *event, *min_event;
+
+	for (i = 0; i < smf->number_of_tracks; i++)
+		next_event_numbers[i] = 1;
+
+	for (;;) {
+		min_track = NULL;
+		min_event = NULL;
+
+		for (i = 0; i < smf->number_of_tracks; i++) {
+			track = g_ptr_array_index(smf->tracks_array, i);
+			if (next_event_numbers[i] > track->number_of_events)
+				continue;
+
+			event = smf_track_get_event_by_number(track, next_event_numbers[i]);
+			if (min_event == NULL || event->time_pulses < min_event->time_pulses) {
+				min_track = track;
+				min_event = event;
+			}
+		}
+
+		if (min_event == NULL)
+			return (count);
+
+		next_event_numbers[min_track->track_number - 1]++;
+		count++;
+	}
+}
+
+int
+main(void)
+{
+	int i, number_of_tracks, count, next_event_numbers[MAX_TRACKS];
+	double start, elapsed_heap, elapsed_scan;
+	smf_t *smf;
+
+	srand(17);
+
+	printf("%8s %10s %18s %18s\n", "tracks", "events", "heap, ns/event", "scan, ns/event");
+
+	for (number_of_tracks = 1; number_of_tracks <= MAX_TRACKS; number_of_tracks *= 2) {
+		smf = make_song(number_of_tracks);
+
+		elapsed_heap = elapsed_scan = 0.0;
+
+		for (i = 0; i < REPETITIONS; i++) {
+			start = now_ms();
+
+			smf_rewind(smf);
+			for (count = 0; smf_get_next_event(smf) != NULL; count++)
+				;
+
+			elapsed_heap += now_ms() - start;
+
+			start = now_ms();
+			if (play_by_scanning(smf, next_event_numbers) != count) {
+				fprintf(stderr, "Number of events does not match.\n");
+				return (1);
+			}
+
+			elapsed_scan += now_ms() - start;
+		}
+
+		printf("%8d %10d %18.2f %18.2f\n", number_of_tracks, count,
+			elapsed_heap * 1000000.0 / REPETITIONS / count, elapsed_scan * 1000000.0 / REPETITIONS / count);
+
+		smf_delete(smf);
+	}
+
+	return (0);
+}
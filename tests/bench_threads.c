@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Benchmark for reading a frozen smf from many threads at once.  Every thread plays the whole
+ * song using its own cursor, so the amount of work per thread stays the same; with perfect
+ * scaling, the time does not change as threads are added, as long as there are enough processors.
+ *
+ * Usage: bench_threads [max_threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+
+#define PASSES			5
+#define NUMBER_OF_TRACKS	16
+#define EVENTS_PER_TRACK	20000
+#define MAX_PULSES		1000000
+#define DEFAULT_MAX_THREADS	16
+
+struct read_job_struct {
+	smf_t		*frozen;
+	int		number_of_events;
+	int		error;
+};
+
+static double
+now_ms(void)
+{
+	return (g_get_monotonic_time() / 1000.0);
+}
+
+static smf_t *
+make_song(void)
+{
+	int i, j, *pulses;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t **events;
+
+	smf = smf_new();
+	events = malloc(EVENTS_PER_TRACK * sizeof(smf_event_t *));
+	pulses = malloc(EVENTS_PER_TRACK * sizeof(int));
+	if (smf == NULL || events == NULL || pulses == NULL)
+		exit(1);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			exit(1);
+
+		smf_add_track(smf, track);
+
+		for (j = 0; j < EVENTS_PER_TRACK; j++) {
+			events[j] = smf_event_new_from_bytes(0x90 | i, j % 128, 100);
+			if (events[j] == NULL)
+				exit(1);
+
+			pulses[j] = rand() % MAX_PULSES;
+		}
+
+		smf_track_add_events(track, events, pulses, EVENTS_PER_TRACK);
+	}
+
+	free(events);
+	free(pulses);
+
+	return (smf);
+}
+
+/*
+ * Plays the song PASSES times using a cursor of its own.
+ */
+static void
+read_job(gpointer data, gpointer user_data)
+{
+	int i, previous_pulses;
+	struct read_job_struct *job = data;
+	smf_cursor_t *cursor;
+	smf_event_t *event;
+
+	(void) user_data;
+
+	cursor = smf_cursor_new(job->frozen);
+	if (cursor == NULL) {
+		job->error = 1;
+		return;
+	}
+
+	for (i = 0; i < PASSES; i++) {
+		smf_cursor_rewind(cursor);
+		previous_pulses = 0;
+
+		while ((event = smf_cursor_get_next_event(cursor)) != NULL) {
+			if (event->time_pulses < previous_pulses)
+				job->error = 1;
+
+			previous_pulses = event->time_pulses;
+			job->number_of_events++;
+		}
+	}
+
+	smf_cursor_delete(cursor);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i, number_of_threads, max_threads = DEFAULT_MAX_THREADS;
+	double start, elapsed, single_thread = 0.0;
+	smf_t *smf, *frozen;
+	GThreadPool *pool;
+	struct read_job_struct *jobs;
+
+	if (argc > 1)
+		max_threads = atoi(argv[1]);
+
+	if (max_threads < 1)
+		max_threads = 1;
+
+	srand(20);
+
+	smf = make_song();
+	frozen = smf_freeze(smf);
+	if (frozen == NULL)
+		return (1);
+
+	smf_delete(smf);
+
+	jobs = calloc(max_threads, sizeof(struct read_job_struct));
+	if (jobs == NULL)
+		return (1);
+
+	printf("%d processors, %d events, %d passes per thread\n", g_get_num_processors(),
+		NUMBER_OF_TRACKS * EVENTS_PER_TRACK, PASSES);
+	printf("%8s %12s %16s %10s\n", "threads", "time, ms", "Mevents/s", "speedup");
+
+	for (number_of_threads = 1; number_of_threads <= max_threads; number_of_threads *= 2) {
+		for (i = 0; i < number_of_threads; i++) {
+			jobs[i].frozen = frozen;
+			jobs[i].number_of_events = 0;
+			jobs[i].error = 0;
+		}
+
+		start = now_ms();
+
+		pool = g_thread_pool_new(read_job, NULL, number_of_threads, TRUE, NULL);
+		if (pool == NULL) {
+			fprintf(stderr, "Cannot create thread pool.\n");
+			return (1);
+		}
+
+		for (i = 0; i < number_of_threads; i++) {
+			if (!g_thread_pool_push(pool, &(jobs[i]), NULL)) {
+				fprintf(stderr, "Cannot start thread.\n");
+				return (1);
+			}
+		}
+
+		/* Wait for the workers to finish. */
+		g_thread_pool_free(pool, FALSE, TRUE);
+
+		elapsed = now_ms() - start;
+
+		for (i = 0; i < number_of_threads; i++) {
+			if (jobs[i].error || jobs[i].number_of_events != PASSES * NUMBER_OF_TRACKS * EVENTS_PER_TRACK) {
+				fprintf(stderr, "Thread %d did not read the song correctly.\n", i);
+				return (1);
+			}
+		}
+
+		if (number_of_threads == 1)
+			single_thread = elapsed;
+
+		printf("%8d %12.3f %16.3f %10.2f\n", number_of_threads, elapsed,
+			(double)number_of_threads * PASSES * NUMBER_OF_TRACKS * EVENTS_PER_TRACK / elapsed / 1000.0,
+			single_thread * number_of_threads / elapsed);
+	}
+
+	free(jobs);
+	smf_delete(frozen);
+
+	return (0);
+}
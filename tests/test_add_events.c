@@ -0,0 +1,189 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that smf_track_add_events() merges unsorted events into the track in the same order
+ * as adding them one by one at the end would: events already in the track go before the new ones
+ * happening at the same time, and new ones happening at the same time keep the order they were passed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_ROUNDS	20
+#define MAX_EVENTS_PER_ROUND	300
+#define MAX_PULSES		1000
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/* Event, with the order it got to the track in; ties are broken by that. */
+struct expected_event_struct {
+	smf_event_t	*event;
+	int		time_pulses;
+	int		order;
+};
+
+static int
+expected_compare_function(const void *aa, const void *bb)
+{
+	const struct expected_event_struct *a = aa, *b = bb;
+
+	if (a->time_pulses != b->time_pulses)
+		return (a->time_pulses < b->time_pulses ? -1 : 1);
+
+	if (a->order != b->order)
+		return (a->order < b->order ? -1 : 1);
+
+	return (0);
+}
+
+/*
+ * Checks that events in "expected", of which there are "count", are the events of the track, in order.
+ */
+static void
+check_track(smf_track_t *track, const struct expected_event_struct *expected, int count)
+{
+	int i, previous_pulses = 0;
+	smf_event_t *event;
+
+	CHECK(track->number_of_events == count, "%d events in the track, expected %d.", track->number_of_events, count);
+
+	for (i = 0; i < count; i++) {
+		event = smf_track_get_event_by_number(track, i + 1);
+
+		CHECK(event == expected[i].event, "Event #%d is not the expected one.", i + 1);
+		CHECK(event->time_pulses == expected[i].time_pulses, "Event #%d happens at %d, expected %d.",
+			i + 1, event->time_pulses, expected[i].time_pulses);
+		CHECK(event->event_number == i + 1, "Event #%d has number %d.", i + 1, event->event_number);
+		CHECK(event->delta_time_pulses == event->time_pulses - previous_pulses,
+			"Event #%d has delta time %d, expected %d.", i + 1, event->delta_time_pulses,
+			event->time_pulses - previous_pulses);
+
+		previous_pulses = event->time_pulses;
+	}
+}
+
+/*
+ * Adds "number_of_events" events at "pulses" to the track using smf_track_add_events(), and to "expected",
+ * which has "count" events.  Returns the new number of events in "expected".
+ */
+static int
+add_events(smf_track_t *track, struct expected_event_struct *expected, int count, const int *pulses,
+	int number_of_events)
+{
+	int i;
+	smf_event_t **events;
+
+	events = malloc(number_of_events * sizeof(smf_event_t *));
+	if (events == NULL)
+		exit(1);
+
+	for (i = 0; i < number_of_events; i++) {
+		events[i] = smf_event_new_from_bytes(0x90, i % 128, 100);
+		if (events[i] == NULL)
+			exit(1);
+
+		expected[count + i].event = events[i];
+		expected[count + i].time_pulses = pulses[i];
+		expected[count + i].order = count + i;
+	}
+
+	smf_track_add_events(track, events, pulses, number_of_events);
+	free(events);
+
+	count += number_of_events;
+	qsort(expected, count, sizeof(struct expected_event_struct), expected_compare_function);
+
+	/* Orders have to keep growing along the track, or the next qsort() would undo the merge. */
+	for (i = 0; i < count; i++)
+		expected[i].order = i;
+
+	return (count);
+}
+
+int
+main(void)
+{
+	static const int first_pulses[] = {0, 10, 10, 20};
+	static const int second_pulses[] = {20, 5, 10, 30, 5, 10, 0, 20};
+	int round, i, count = 0, number_of_events, *pulses;
+	smf_t *smf;
+	smf_track_t *track;
+	struct expected_event_struct *expected;
+
+	smf = smf_new();
+	track = smf_track_new();
+	expected = malloc((NUMBER_OF_ROUNDS * MAX_EVENTS_PER_ROUND + 12) * sizeof(struct expected_event_struct));
+	pulses = malloc(MAX_EVENTS_PER_ROUND * sizeof(int));
+	if (smf == NULL || track == NULL || expected == NULL || pulses == NULL)
+		return (1);
+
+	smf_add_track(smf, track);
+
+	/* Unsorted, with ties among themselves and with the events already there. */
+	count = add_events(track, expected, count, first_pulses, 4);
+	count = add_events(track, expected, count, second_pulses, 8);
+
+	CHECK(smf_track_get_event_by_number(track, 2) == expected[1].event &&
+		expected[1].event->midi_buffer[1] == 6, "Second event at 0 is not the one added last.");
+	check_track(track, expected, count);
+
+	srand(13);
+
+	for (round = 0; round < NUMBER_OF_ROUNDS; round++) {
+		number_of_events = 1 + rand() % MAX_EVENTS_PER_ROUND;
+
+		for (i = 0; i < number_of_events; i++)
+			pulses[i] = rand() % MAX_PULSES;
+
+		count = add_events(track, expected, count, pulses, number_of_events);
+		check_track(track, expected, count);
+	}
+
+	smf_delete(smf);
+	free(expected);
+	free(pulses);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
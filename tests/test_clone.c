@@ -0,0 +1,331 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that smf_clone() makes a copy with the same contents, and that editing the copy
+ * does not change the original, or the other way around.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_TRACKS	6
+#define MAX_EVENTS_PER_TRACK	300
+#define MAX_PULSES		2000
+#define MAX_SNAPSHOT_BYTES	16
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/* What an event looked like when the snapshot was taken. */
+struct snapshot_event_struct {
+	smf_event_t	*event;
+	int		track_number;
+	int		time_pulses;
+	int		delta_time_pulses;
+	double		time_seconds;
+	int		midi_buffer_length;
+	unsigned char	midi_buffer[MAX_SNAPSHOT_BYTES];
+};
+
+/* Contents of the smf, taken by take_snapshot(). */
+struct snapshot_struct {
+	int				number_of_tracks;
+	int				number_of_events;
+	int				number_of_tempos;
+	int				length_pulses;
+	struct snapshot_event_struct	*events;
+	smf_tempo_t			*tempos;
+};
+
+static void
+take_snapshot(smf_t *smf, struct snapshot_struct *snapshot)
+{
+	int i, j, number_of_events = 0;
+	smf_track_t *track;
+	smf_event_t *event;
+	smf_tempo_t *tempo;
+	struct snapshot_event_struct *snapshot_event;
+
+	memset(snapshot, 0, sizeof(struct snapshot_struct));
+
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		number_of_events += smf_get_track_by_number(smf, i)->number_of_events;
+
+	for (i = 0; smf_get_tempo_by_number(smf, i) != NULL; i++)
+		;
+
+	snapshot->events = malloc((number_of_events + 1) * sizeof(struct snapshot_event_struct));
+	snapshot->tempos = malloc(i * sizeof(smf_tempo_t));
+	if (snapshot->events == NULL || snapshot->tempos == NULL)
+		exit(1);
+
+	snapshot->number_of_tracks = smf->number_of_tracks;
+	snapshot->number_of_tempos = i;
+	snapshot->length_pulses = smf_get_length_pulses(smf);
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		track = smf_get_track_by_number(smf, i);
+
+		for (j = 1; j <= track->number_of_events; j++) {
+			event = smf_track_get_event_by_number(track, j);
+			snapshot_event = snapshot->events + snapshot->number_of_events++;
+
+			memset(snapshot_event, 0, sizeof(struct snapshot_event_struct));
+			snapshot_event->event = event;
+			snapshot_event->track_number = i;
+			snapshot_event->time_pulses = event->time_pulses;
+			snapshot_event->delta_time_pulses = event->delta_time_pulses;
+			snapshot_event->time_seconds = event->time_seconds;
+			snapshot_event->midi_buffer_length = event->midi_buffer_length;
+			memcpy(snapshot_event->midi_buffer, event->midi_buffer,
+				event->midi_buffer_length < MAX_SNAPSHOT_BYTES ? event->midi_buffer_length : MAX_SNAPSHOT_BYTES);
+		}
+	}
+
+	for (i = 0; i < snapshot->number_of_tempos; i++) {
+		tempo = smf_get_tempo_by_number(smf, i);
+		snapshot->tempos[i] = *tempo;
+	}
+}
+
+static void
+free_snapshot(struct snapshot_struct *snapshot)
+{
+	free(snapshot->events);
+	free(snapshot->tempos);
+}
+
+/*
+ * Checks that the snapshots are the same.  If "same_events" is nonzero, they need to be made of the same
+ * smf_event_t structures; otherwise, none of the structures may be shared.
+ */
+static void
+compare_snapshots(const struct snapshot_struct *a, const struct snapshot_struct *b, int same_events, const char *when)
+{
+	int i;
+	const struct snapshot_event_struct *event_a, *event_b;
+
+	CHECK(a->number_of_tracks == b->number_of_tracks, "%s: %d tracks instead of %d.", when,
+		b->number_of_tracks, a->number_of_tracks);
+	CHECK(a->length_pulses == b->length_pulses, "%s: length is %d instead of %d.", when,
+		b->length_pulses, a->length_pulses);
+	CHECK(a->number_of_events == b->number_of_events, "%s: %d events instead of %d.", when,
+		b->number_of_events, a->number_of_events);
+	CHECK(a->number_of_tempos == b->number_of_tempos, "%s: %d tempos instead of %d.", when,
+		b->number_of_tempos, a->number_of_tempos);
+
+	for (i = 0; i < a->number_of_events && i < b->number_of_events; i++) {
+		event_a = a->events + i;
+		event_b = b->events + i;
+
+		if (event_a->track_number != event_b->track_number || event_a->time_pulses != event_b->time_pulses ||
+			event_a->delta_time_pulses != event_b->delta_time_pulses ||
+			event_a->time_seconds != event_b->time_seconds ||
+			event_a->midi_buffer_length != event_b->midi_buffer_length ||
+			memcmp(event_a->midi_buffer, event_b->midi_buffer, MAX_SNAPSHOT_BYTES) != 0) {
+			CHECK(0, "%s: event #%d of the song differs.", when, i + 1);
+			return;
+		}
+
+		if ((event_a->event == event_b->event) != same_events) {
+			CHECK(0, "%s: event #%d of the song is %s.", when, i + 1, same_events ? "not the same" : "shared");
+			return;
+		}
+	}
+
+	for (i = 0; i < a->number_of_tempos && i < b->number_of_tempos; i++) {
+		if (a->tempos[i].time_pulses != b->tempos[i].time_pulses ||
+			a->tempos[i].time_seconds != b->tempos[i].time_seconds ||
+			a->tempos[i].microseconds_per_quarter_note != b->tempos[i].microseconds_per_quarter_note ||
+			a->tempos[i].numerator != b->tempos[i].numerator ||
+			a->tempos[i].denominator != b->tempos[i].denominator) {
+			CHECK(0, "%s: tempo #%d differs.", when, i + 1);
+			return;
+		}
+	}
+}
+
+static smf_event_t *
+new_event(int i)
+{
+	static const unsigned char sysex_data[] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0x12, 0x34, 0xF7};
+	static unsigned char tempo_data[] = {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20};
+	smf_event_t *event;
+
+	/* Long enough not to fit inside the event, short, and a tempo change every now and then. */
+	if (i % 50 == 0) {
+		event = smf_event_new_from_pointer((void *)sysex_data, sizeof(sysex_data));
+	} else if (i % 97 == 0) {
+		tempo_data[3] = 0x03 + i % 8;
+		event = smf_event_new_from_pointer(tempo_data, sizeof(tempo_data));
+	} else {
+		event = smf_event_new_from_bytes(0x90 | (i % 16), i % 128, 100);
+	}
+
+	if (event == NULL)
+		exit(1);
+
+	return (event);
+}
+
+/* Used with smf_track_remove_events_if(). */
+static int
+every_third(const smf_event_t *event, void *user_pointer)
+{
+	return (event->event_number % 3 == 0);
+}
+
+/*
+ * Edits the song in every way that should not leak into other copies of it.
+ */
+static void
+edit(smf_t *smf)
+{
+	int i;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	for (i = 0; i < 100; i++)
+		smf_track_add_event_pulses(smf_get_track_by_number(smf, 1 + i % smf->number_of_tracks), new_event(i + 1),
+			rand() % MAX_PULSES);
+
+	track = smf_get_track_by_number(smf, 2);
+	for (i = 0; i < 20 && track->number_of_events > 0; i++) {
+		event = smf_track_get_event_by_number(track, 1 + rand() % track->number_of_events);
+		smf_event_delete(event);
+	}
+
+	CHECK(smf_track_remove_events_if(smf_get_track_by_number(smf, 3), every_third, NULL) >= 0, "Cannot remove events.");
+
+	/* Moves all the events after it in time. */
+	smf_track_add_event_pulses(smf_get_track_by_number(smf, 1), new_event(97), MAX_PULSES / 3);
+
+	CHECK(smf_track_move(smf_get_track_by_number(smf, 4), 1) == 0, "Cannot move track.");
+	smf_track_delete(smf_get_track_by_number(smf, smf->number_of_tracks));
+}
+
+int
+main(void)
+{
+	int i, j, number_of_events;
+	smf_t *smf, *clone, *frozen;
+	smf_track_t *track;
+	struct snapshot_struct original, copy, edited;
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (1);
+
+	srand(21);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (1);
+
+		smf_add_track(smf, track);
+
+		number_of_events = rand() % MAX_EVENTS_PER_TRACK;
+
+		for (j = 0; j < number_of_events; j++)
+			smf_track_add_event_pulses(track, new_event(j), rand() % MAX_PULSES);
+	}
+
+	take_snapshot(smf, &original);
+
+	/* Same contents, in structures of its own. */
+	clone = smf_clone(smf);
+	if (clone == NULL)
+		return (1);
+
+	take_snapshot(clone, &copy);
+	compare_snapshots(&original, &copy, 0, "Clone");
+	free_snapshot(&copy);
+
+	/* Editing the copy leaves the original alone... */
+	edit(clone);
+
+	take_snapshot(smf, &copy);
+	compare_snapshots(&original, &copy, 1, "Original after editing the clone");
+	free_snapshot(&copy);
+
+	/* ...and the other way around. */
+	take_snapshot(clone, &edited);
+	edit(smf);
+
+	take_snapshot(clone, &copy);
+	compare_snapshots(&edited, &copy, 1, "Clone after editing the original");
+	free_snapshot(&copy);
+	free_snapshot(&edited);
+	free_snapshot(&original);
+
+	/* Frozen smf can be cloned too. */
+	frozen = smf_freeze(smf);
+	if (frozen == NULL)
+		return (1);
+
+	smf_delete(clone);
+	clone = smf_clone(frozen);
+	if (clone == NULL)
+		return (1);
+
+	take_snapshot(frozen, &original);
+	take_snapshot(clone, &copy);
+	compare_snapshots(&original, &copy, 0, "Clone of frozen smf");
+	free_snapshot(&copy);
+
+	edit(clone);
+
+	take_snapshot(frozen, &copy);
+	compare_snapshots(&original, &copy, 1, "Frozen smf after editing the clone");
+	free_snapshot(&copy);
+	free_snapshot(&original);
+
+	smf_delete(clone);
+	smf_delete(frozen);
+	smf_delete(smf);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,239 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that cursors return the same events as smf_get_next_event(), both from the start and
+ * after seeking, and that reading from them does not change the position of the smf.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_TRACKS	11
+#define MAX_EVENTS_PER_TRACK	300
+#define MAX_PULSES		1000
+#define NUMBER_OF_SEEKS		50
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Puts the events smf_get_next_event() returns from the current position into "events",
+ * which needs room for all of them, and returns their number.
+ */
+static int
+drain_smf(smf_t *smf, smf_event_t **events)
+{
+	int count = 0;
+	smf_event_t *event;
+
+	while ((event = smf_get_next_event(smf)) != NULL)
+		events[count++] = event;
+
+	return (count);
+}
+
+/*
+ * Checks that the cursor returns "expected", of which there are "count", and nothing else.
+ */
+static void
+check_cursor(smf_cursor_t *cursor, smf_event_t **expected, int count, const char *when)
+{
+	int i;
+	smf_event_t *event;
+
+	for (i = 0; i < count; i++) {
+		CHECK(smf_cursor_peek_next_event(cursor) == expected[i], "%s: event #%d peeked is not the expected one.",
+			when, i + 1);
+
+		event = smf_cursor_get_next_event(cursor);
+		if (event != expected[i]) {
+			CHECK(0, "%s: event #%d is not the expected one.", when, i + 1);
+			return;
+		}
+	}
+
+	CHECK(smf_cursor_get_next_event(cursor) == NULL, "%s: cursor has more events than expected.", when);
+}
+
+/*
+ * Checks cursors on "smf", which may be frozen.  "expected" holds all the events of the song,
+ * in the order smf_get_next_event() returns them.
+ */
+static void
+check_cursors(smf_t *smf, smf_event_t **expected, int count, smf_event_t **buffer)
+{
+	int i, pulses, position, number_of_events;
+	smf_cursor_t *cursor, *other;
+
+	cursor = smf_cursor_new(smf);
+	other = smf_cursor_new(smf);
+	if (cursor == NULL || other == NULL)
+		exit(1);
+
+	check_cursor(cursor, expected, count, "From the start");
+
+	/* Two cursors don't disturb each other. */
+	for (i = 0; i < count / 2; i++)
+		CHECK(smf_cursor_get_next_event(other) == expected[i], "Other cursor: event #%d is not the expected one.", i + 1);
+
+	smf_cursor_rewind(cursor);
+	check_cursor(cursor, expected, count, "After rewind");
+	check_cursor(other, expected + count / 2, count - count / 2, "Other cursor, second half");
+
+	if (smf_is_frozen(smf)) {
+		smf_cursor_delete(cursor);
+		smf_cursor_delete(other);
+		return;
+	}
+
+	/* Seeks work like the ones of the smf. */
+	for (i = 0; i < NUMBER_OF_SEEKS; i++) {
+		pulses = rand() % MAX_PULSES;
+
+		CHECK(smf_seek_to_pulses(smf, pulses) == 0, "Cannot seek to %d pulses.", pulses);
+		number_of_events = drain_smf(smf, buffer);
+
+		CHECK(smf_cursor_seek_to_pulses(cursor, pulses) == 0, "Cannot seek cursor to %d pulses.", pulses);
+		check_cursor(cursor, buffer, number_of_events, "After seeking to pulses");
+
+		position = rand() % count;
+
+		CHECK(smf_seek_to_seconds(smf, expected[position]->time_seconds) == 0, "Cannot seek to seconds.");
+		number_of_events = drain_smf(smf, buffer);
+
+		CHECK(smf_cursor_seek_to_seconds(cursor, expected[position]->time_seconds) == 0, "Cannot seek cursor to seconds.");
+		check_cursor(cursor, buffer, number_of_events, "After seeking to seconds");
+
+		CHECK(smf_cursor_seek_to_event(cursor, expected[position]) == 0, "Cannot seek cursor to event.");
+		check_cursor(cursor, expected + position, count - position, "After seeking to event");
+	}
+
+	smf_cursor_delete(cursor);
+	smf_cursor_delete(other);
+}
+
+int
+main(void)
+{
+	int i, j, total = 0, count, number_of_events;
+	smf_t *smf, *frozen;
+	smf_track_t *track;
+	smf_event_t *event, **expected, **buffer;
+	smf_cursor_t *cursor;
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (1);
+
+	srand(19);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (1);
+
+		smf_add_track(smf, track);
+
+		number_of_events = 1 + rand() % MAX_EVENTS_PER_TRACK;
+
+		for (j = 0; j < number_of_events; j++) {
+			event = smf_event_new_from_bytes(0x90, i, 100);
+			if (event == NULL)
+				return (1);
+
+			smf_track_add_event_pulses(track, event, rand() % MAX_PULSES);
+		}
+
+		total += number_of_events;
+	}
+
+	expected = malloc(total * sizeof(smf_event_t *));
+	buffer = malloc(total * sizeof(smf_event_t *));
+	if (expected == NULL || buffer == NULL)
+		return (1);
+
+	smf_rewind(smf);
+	count = drain_smf(smf, expected);
+	CHECK(count == total, "Song has %d events, expected %d.", count, total);
+
+	/* Reading from a cursor in between does not move the smf. */
+	smf_rewind(smf);
+	cursor = smf_cursor_new(smf);
+	if (cursor == NULL)
+		return (1);
+
+	for (i = 0; i < count; i++) {
+		event = expected[(i * 7) % count];
+
+		CHECK(smf_cursor_seek_to_event(cursor, event) == 0, "Cannot seek cursor to event.");
+		CHECK(smf_cursor_get_next_event(cursor) == event, "Cursor did not return the event it was seeked to.");
+
+		if (smf_get_next_event(smf) != expected[i]) {
+			CHECK(0, "Event #%d of the smf changed while reading from a cursor.", i + 1);
+			break;
+		}
+	}
+
+	smf_cursor_delete(cursor);
+
+	check_cursors(smf, expected, count, buffer);
+
+	frozen = smf_freeze(smf);
+	if (frozen == NULL)
+		return (1);
+
+	/* Events of the snapshot are copies; find them by position. */
+	for (i = 0; i < count; i++)
+		expected[i] = smf_track_get_event_by_number(smf_get_track_by_number(frozen, expected[i]->track->track_number),
+			expected[i]->event_number);
+
+	check_cursors(frozen, expected, count, buffer);
+
+	smf_delete(frozen);
+	smf_delete(smf);
+	free(expected);
+	free(buffer);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,258 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks table-driven status byte lookup and VLQ decoding against the original,
+ * straightforward implementations.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smf.h"
+#include "smf_private.h"
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Reference implementations, as they were before the lookup table.  Where
+ * the original asserted (data bytes, SysEx, escape), reference_message_length()
+ * returns 0 instead, meaning "not applicable".
+ */
+static int
+reference_extract_vlq(const unsigned char *buf, const int buffer_length, int *value, int *len)
+{
+	int val = 0;
+	const unsigned char *c = buf;
+
+	for (;;) {
+		if (c >= buf + buffer_length)
+			return (-1);
+
+		val = (val << 7) + (*c & 0x7F);
+
+		if (*c & 0x80)
+			c++;
+		else
+			break;
+	};
+
+	*value = val;
+	*len = c - buf + 1;
+
+	if (*len > 4)
+		return (-2);
+
+	return (0);
+}
+
+static int
+reference_message_length(unsigned char status, const unsigned char *second_byte, const int buffer_length)
+{
+	if (!(status & 0x80) || status == 0xF0 || status == 0xF7)
+		return (0);
+
+	if (status == 0xFF) {
+		if (buffer_length < 2)
+			return (-1);
+
+		return (*(second_byte + 1) + 3);
+	}
+
+	if ((status & 0xF0) == 0xF0) {
+		switch (status) {
+			case 0xF2:
+				return (3);
+
+			case 0xF1:
+			case 0xF3:
+				return (2);
+
+			case 0xF6:
+			case 0xF8:
+			case 0xF9:
+			case 0xFA:
+			case 0xFB:
+			case 0xFC:
+			case 0xFE:
+				return (1);
+
+			default:
+				return (-2);
+		}
+	}
+
+	switch (status & 0xF0) {
+		case 0x80:
+		case 0x90:
+		case 0xA0:
+		case 0xB0:
+		case 0xE0:
+			return (3);
+
+		default:
+			return (2);
+	}
+}
+
+static void
+quiet_log_handler(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data)
+{
+}
+
+static void
+test_message_length(void)
+{
+	int status, i, buffer_length, expected, got;
+	unsigned char second_bytes[][2] = {{0x00, 0x00}, {0x51, 0x03}, {0x2F, 0x00}, {0x01, 0x7F}};
+
+	for (status = 0; status <= 0xFF; status++) {
+		for (i = 0; i < (int)(sizeof(second_bytes) / sizeof(*second_bytes)); i++) {
+			for (buffer_length = 0; buffer_length <= 2; buffer_length++) {
+				expected = reference_message_length(status, second_bytes[i], buffer_length);
+				got = smf_expected_message_length(status, second_bytes[i], buffer_length);
+
+				if (expected == 0)
+					CHECK(got < 0, "status 0x%02X: expected error, got %d.", status, got);
+				else
+					CHECK(got == expected, "status 0x%02X, buffer length %d: expected %d, got %d.",
+						status, buffer_length, expected, got);
+			}
+		}
+	}
+}
+
+static void
+check_vlq(const unsigned char *buf, int buffer_length)
+{
+	int expected, got, expected_value = -1, expected_len = -1, value = -1, len = -1;
+
+	expected = reference_extract_vlq(buf, buffer_length, &expected_value, &expected_len);
+	got = smf_extract_vlq(buf, buffer_length, &value, &len);
+
+	CHECK(got == expected, "VLQ 0x%02X..., buffer length %d: expected return %d, got %d.",
+		buf[0], buffer_length, expected, got);
+
+	if (expected == 0 && got == 0)
+		CHECK(value == expected_value && len == expected_len,
+			"VLQ 0x%02X..., buffer length %d: expected %d (%d bytes), got %d (%d bytes).",
+			buf[0], buffer_length, expected_value, expected_len, value, len);
+}
+
+static int
+encode_vlq(unsigned char *buf, int value)
+{
+	unsigned char tmp[5];
+	int i = 0, len = 0;
+
+	do {
+		tmp[i++] = value & 0x7F;
+		value >>= 7;
+	} while (value);
+
+	while (i > 0) {
+		buf[len] = tmp[--i];
+		if (i > 0)
+			buf[len] |= 0x80;
+		len++;
+	}
+
+	return (len);
+}
+
+static void
+test_vlq(void)
+{
+	int values[] = {0, 1, 0x40, 0x7F, 0x80, 0x2000, 0x3FFF, 0x4000, 0x100000, 0x1FFFFF, 0x200000,
+		0x8000000, 0x0FFFFFFF};
+	unsigned char buf[8];
+	int i, len, buffer_length;
+
+	for (i = 0; i < (int)(sizeof(values) / sizeof(*values)); i++) {
+		memset(buf, 0x55, sizeof(buf));
+		len = encode_vlq(buf, values[i]);
+
+		/* Exact and longer buffers. */
+		for (buffer_length = len; buffer_length <= (int)sizeof(buf); buffer_length++)
+			check_vlq(buf, buffer_length);
+
+		/* Truncated. */
+		for (buffer_length = 1; buffer_length < len; buffer_length++)
+			check_vlq(buf, buffer_length);
+	}
+
+	/* Continuation bytes up to the end of buffer. */
+	memset(buf, 0x81, sizeof(buf));
+	for (buffer_length = 1; buffer_length <= (int)sizeof(buf); buffer_length++)
+		check_vlq(buf, buffer_length);
+
+	/* Overlong: terminated by the fifth or later byte. */
+	for (len = 5; len <= (int)sizeof(buf); len++) {
+		memset(buf, 0x81, sizeof(buf));
+		buf[len - 1] = 0x01;
+		for (buffer_length = 1; buffer_length <= (int)sizeof(buf); buffer_length++)
+			check_vlq(buf, buffer_length);
+	}
+
+	/* Every combination of the first two bytes, with the rest set to a continuation pattern. */
+	for (i = 0; i <= 0xFFFF; i++) {
+		memset(buf, 0x80, sizeof(buf));
+		buf[0] = i >> 8;
+		buf[1] = i & 0xFF;
+		for (buffer_length = 1; buffer_length <= 6; buffer_length++)
+			check_vlq(buf, buffer_length);
+		buf[3] = 0x7F;
+		check_vlq(buf, 4);
+		check_vlq(buf, sizeof(buf));
+	}
+}
+
+int
+main(void)
+{
+	g_log_set_default_handler(quiet_log_handler, NULL);
+
+	test_message_length();
+	test_vlq();
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
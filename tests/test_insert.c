@@ -0,0 +1,161 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that inserting events in the middle of a track puts them where sorting the whole track
+ * used to - before the events already there at the same time - and fixes delta times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_EVENTS	2000
+#define MAX_PULSES		500
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Checks that "expected", of which there are "count", are the events of the track, in order.
+ */
+static void
+check_track(smf_track_t *track, smf_event_t **expected, int count)
+{
+	int i, previous_pulses = 0;
+	smf_event_t *event;
+
+	CHECK(track->number_of_events == count, "%d events in the track, expected %d.", track->number_of_events, count);
+
+	for (i = 0; i < count; i++) {
+		event = smf_track_get_event_by_number(track, i + 1);
+
+		CHECK(event == expected[i], "Event #%d is not the expected one.", i + 1);
+		CHECK(expected[i]->event_number == i + 1, "Event #%d has number %d.", i + 1, expected[i]->event_number);
+		CHECK(expected[i]->delta_time_pulses == expected[i]->time_pulses - previous_pulses,
+			"Event #%d has delta time %d, expected %d.", i + 1, expected[i]->delta_time_pulses,
+			expected[i]->time_pulses - previous_pulses);
+
+		previous_pulses = expected[i]->time_pulses;
+	}
+}
+
+/*
+ * Adds a Note On at "pulses" to the track, and at the place the track should put it to "expected":
+ * after the last event, if it does not happen before it, or else before the first event that does
+ * not happen before it.  Returns the new number of events in "expected".
+ */
+static int
+add_event(smf_track_t *track, smf_event_t **expected, int count, int pulses)
+{
+	int position;
+	smf_event_t *event;
+
+	event = smf_event_new_from_bytes(0x90, 60, 100);
+	if (event == NULL)
+		exit(1);
+
+	smf_track_add_event_pulses(track, event, pulses);
+
+	if (count == 0 || expected[count - 1]->time_pulses <= pulses) {
+		position = count;
+	} else {
+		for (position = 0; expected[position]->time_pulses < pulses; position++)
+			;
+	}
+
+	memmove(expected + position + 1, expected + position, (count - position) * sizeof(smf_event_t *));
+	expected[position] = event;
+
+	return (count + 1);
+}
+
+int
+main(void)
+{
+	int count = 0;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t **expected, *inserted;
+
+	smf = smf_new();
+	track = smf_track_new();
+	expected = malloc(NUMBER_OF_EVENTS * sizeof(smf_event_t *));
+	if (smf == NULL || track == NULL || expected == NULL)
+		return (1);
+
+	smf_add_track(smf, track);
+
+	/*
+	 * Event inserted at 10 goes before the two already there; the second one at 30 is appended,
+	 * so it goes after the first one.
+	 */
+	count = add_event(track, expected, count, 10);
+	count = add_event(track, expected, count, 10);
+	count = add_event(track, expected, count, 30);
+	count = add_event(track, expected, count, 10);
+	inserted = expected[0];
+	count = add_event(track, expected, count, 30);
+	count = add_event(track, expected, count, 20);
+	count = add_event(track, expected, count, 0);
+
+	CHECK(smf_track_get_event_by_number(track, 2) == inserted, "Event inserted at 10 is not before the others.");
+	check_track(track, expected, count);
+
+	/* Then lots of them at random places, with many ties. */
+	srand(12);
+
+	while (count < NUMBER_OF_EVENTS) {
+		count = add_event(track, expected, count, rand() % MAX_PULSES);
+
+		if (count % 100 == 0)
+			check_track(track, expected, count);
+	}
+
+	check_track(track, expected, count);
+
+	smf_delete(smf);
+	free(expected);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,213 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that smf_get_next_event() returns events in the same order as the linear scan over tracks
+ * it used before the heap: earliest event first, and events happening at the same time in the order
+ * of tracks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_TRACKS	37
+#define MAX_EVENTS_PER_TRACK	200
+#define MAX_PULSES		400
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Returns events of the song in the order the linear scan would: every time, the next event
+ * of the first track whose next event happens earliest.  Caller frees the array.
+ */
+static smf_event_t **
+reference_events(smf_t *smf, int *number_of_events)
+{
+	int i, count = 0, total = 0, *next;
+	smf_track_t *track, *min_time_track;
+	smf_event_t *event, *min_time_event, **events;
+
+	next = calloc(smf->number_of_tracks + 1, sizeof(int));
+	if (next == NULL)
+		exit(1);
+
+	for (i = 1; i <= smf->number_of_tracks; i++) {
+		next[i] = 1;
+		total += smf_get_track_by_number(smf, i)->number_of_events;
+	}
+
+	events = malloc((total + 1) * sizeof(smf_event_t *));
+	if (events == NULL)
+		exit(1);
+
+	for (;;) {
+		min_time_track = NULL;
+		min_time_event = NULL;
+
+		for (i = 1; i <= smf->number_of_tracks; i++) {
+			track = smf_get_track_by_number(smf, i);
+			event = smf_track_get_event_by_number(track, next[i]);
+
+			/* No more events in this track? */
+			if (event == NULL)
+				continue;
+
+			if (min_time_event == NULL || event->time_pulses < min_time_event->time_pulses) {
+				min_time_event = event;
+				min_time_track = track;
+			}
+		}
+
+		if (min_time_event == NULL)
+			break;
+
+		events[count++] = min_time_event;
+		next[min_time_track->track_number]++;
+	}
+
+	free(next);
+
+	*number_of_events = count;
+
+	return (events);
+}
+
+/*
+ * Rewinds the song and checks that smf_get_next_event(), mixed with smf_peek_next_event(),
+ * returns the same events as the linear scan.
+ */
+static void
+check_order(smf_t *smf, const char *when)
+{
+	int i, number_of_events;
+	smf_event_t **expected, *event, *peeked;
+
+	expected = reference_events(smf, &number_of_events);
+
+	smf_rewind(smf);
+
+	for (i = 0; i < number_of_events; i++) {
+		peeked = NULL;
+		if (i % 3 == 0)
+			peeked = smf_peek_next_event(smf);
+
+		event = smf_get_next_event(smf);
+
+		CHECK(event == expected[i], "%s: event #%d of the song is not the expected one.", when, i + 1);
+		CHECK(peeked == NULL || peeked == event, "%s: event #%d differs from the one peeked.", when, i + 1);
+
+		if (event != expected[i])
+			break;
+	}
+
+	CHECK(smf_get_next_event(smf) == NULL, "%s: there are more events than expected.", when);
+
+	free(expected);
+}
+
+/* Used with smf_track_remove_events_if(). */
+static int
+every_fifth(const smf_event_t *event, void *user_pointer)
+{
+	int *counter = user_pointer;
+
+	(void) event;
+
+	return ((*counter)++ % 5 == 0);
+}
+
+int
+main(void)
+{
+	int i, j, number_of_events, counter = 0;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event;
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (1);
+
+	srand(17);
+
+	/* Few distinct times, so there are lots of ties between the tracks. */
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (1);
+
+		smf_add_track(smf, track);
+
+		number_of_events = rand() % MAX_EVENTS_PER_TRACK;
+
+		for (j = 0; j < number_of_events; j++) {
+			event = smf_event_new_from_bytes(0x90, i, 100);
+			if (event == NULL)
+				return (1);
+
+			smf_track_add_event_pulses(track, event, rand() % MAX_PULSES);
+		}
+	}
+
+	check_order(smf, "Loaded");
+
+	/* Track numbers decide ties, so moving tracks changes the order. */
+	CHECK(smf_track_move(smf_get_track_by_number(smf, NUMBER_OF_TRACKS), 1) == 0, "Cannot move track.");
+	CHECK(smf_track_move(smf_get_track_by_number(smf, 2), NUMBER_OF_TRACKS - 3) == 0, "Cannot move track.");
+	check_order(smf, "After moving tracks");
+
+	for (i = 1; i <= smf->number_of_tracks; i += 4)
+		CHECK(smf_track_remove_events_if(smf_get_track_by_number(smf, i), every_fifth, &counter) >= 0,
+			"Cannot remove events.");
+
+	check_order(smf, "After removing events");
+
+	smf_track_delete(smf_get_track_by_number(smf, 5));
+	smf_track_delete(smf_get_track_by_number(smf, 1));
+	check_order(smf, "After deleting tracks");
+
+	smf_delete(smf);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,297 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that range queries find the events at or after the start of the time window and before
+ * its end, including windows that start or end exactly at events, and that they don't change
+ * the position in the song.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_TRACKS	7
+#define MAX_EVENTS_PER_TRACK	300
+#define MAX_PULSES		1000
+#define NUMBER_OF_QUERIES	300
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/* Time window; if "from_pulses" is -1, the window is given in seconds. */
+struct window_struct {
+	int	from_pulses;
+	int	to_pulses;
+	double	from_seconds;
+	double	to_seconds;
+};
+
+static int
+is_in_window(const smf_event_t *event, const struct window_struct *window)
+{
+	if (window->from_pulses >= 0)
+		return (event->time_pulses >= window->from_pulses && event->time_pulses < window->to_pulses);
+
+	return (event->time_seconds >= window->from_seconds && event->time_seconds < window->to_seconds);
+}
+
+/*
+ * Checks smf_track_get_events_in_range_*() against going through all the events of the track.
+ */
+static void
+check_track_query(smf_track_t *track, const struct window_struct *window)
+{
+	int i, found = 0, number_of_events;
+	smf_event_t *event, **events;
+
+	if (window->from_pulses >= 0)
+		events = smf_track_get_events_in_range_pulses(track, window->from_pulses, window->to_pulses, &number_of_events);
+	else
+		events = smf_track_get_events_in_range_seconds(track, window->from_seconds, window->to_seconds, &number_of_events);
+
+	for (i = 1; i <= track->number_of_events; i++) {
+		event = smf_track_get_event_by_number(track, i);
+		if (!is_in_window(event, window))
+			continue;
+
+		if (found >= number_of_events || events[found] != event) {
+			CHECK(0, "Track %d, window %d - %d pulses, %f - %f seconds: event #%d is not where expected.",
+				track->track_number, window->from_pulses, window->to_pulses, window->from_seconds,
+				window->to_seconds, i);
+			return;
+		}
+
+		found++;
+	}
+
+	CHECK(found == number_of_events, "Track %d, window %d - %d pulses, %f - %f seconds: %d events found, expected %d.",
+		track->track_number, window->from_pulses, window->to_pulses, window->from_seconds, window->to_seconds,
+		number_of_events, found);
+}
+
+/*
+ * Checks smf_get_events_in_range_*() against playing the whole song.  "song" holds all the events,
+ * in the order smf_get_next_event() returns them; "events" has room for all of them.
+ */
+static void
+check_song_query(smf_t *smf, const struct window_struct *window, smf_event_t **song, int count, smf_event_t **events)
+{
+	int i, found = 0, number_of_events, truncated;
+	smf_event_t *next_event;
+
+	/* Position in the song stays where it is. */
+	next_event = smf_peek_next_event(smf);
+
+	if (window->from_pulses >= 0) {
+		number_of_events = smf_get_events_in_range_pulses(smf, window->from_pulses, window->to_pulses, events, count);
+		truncated = smf_get_events_in_range_pulses(smf, window->from_pulses, window->to_pulses, events, 1);
+	} else {
+		number_of_events = smf_get_events_in_range_seconds(smf, window->from_seconds, window->to_seconds, events, count);
+		truncated = smf_get_events_in_range_seconds(smf, window->from_seconds, window->to_seconds, events, 1);
+	}
+
+	CHECK(smf_peek_next_event(smf) == next_event, "Range query changed position in the song.");
+	CHECK(truncated == number_of_events, "Range query found %d events with short array, %d with long one.",
+		truncated, number_of_events);
+
+	/* Get the full results back; the short query above overwrote the first one. */
+	if (window->from_pulses >= 0)
+		number_of_events = smf_get_events_in_range_pulses(smf, window->from_pulses, window->to_pulses, events, count);
+	else
+		number_of_events = smf_get_events_in_range_seconds(smf, window->from_seconds, window->to_seconds, events, count);
+
+	for (i = 0; i < count; i++) {
+		if (!is_in_window(song[i], window))
+			continue;
+
+		if (found >= number_of_events || events[found] != song[i]) {
+			CHECK(0, "Window %d - %d pulses, %f - %f seconds: event #%d of the song is not where expected.",
+				window->from_pulses, window->to_pulses, window->from_seconds, window->to_seconds, i + 1);
+			return;
+		}
+
+		found++;
+	}
+
+	CHECK(found == number_of_events, "Window %d - %d pulses, %f - %f seconds: %d events found, expected %d.",
+		window->from_pulses, window->to_pulses, window->from_seconds, window->to_seconds, number_of_events, found);
+}
+
+static void
+check_window(smf_t *smf, const struct window_struct *window, smf_event_t **song, int count, smf_event_t **events)
+{
+	int i;
+
+	for (i = 1; i <= smf->number_of_tracks; i++)
+		check_track_query(smf_get_track_by_number(smf, i), window);
+
+	check_song_query(smf, window, song, count, events);
+}
+
+/*
+ * Track with events at 0, 0, 10, 10, 10, 20, 30 and 30 pulses.
+ */
+static void
+check_boundaries(void)
+{
+	static const int pulses[] = {0, 0, 10, 10, 10, 20, 30, 30};
+	static const int windows[][3] = {
+		/* From, to, number of events. */
+		{0, 10, 2}, {0, 1, 2}, {10, 10, 0}, {10, 11, 3}, {9, 10, 0}, {10, 30, 4},
+		{20, 21, 1}, {21, 30, 0}, {30, 31, 2}, {31, 100, 0}, {0, 31, 8}, {25, 30, 0}};
+	int i, number_of_events;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t **events;
+
+	smf = smf_new();
+	track = smf_track_new();
+	if (smf == NULL || track == NULL)
+		exit(1);
+
+	smf_add_track(smf, track);
+
+	for (i = 0; i < sizeof(pulses) / sizeof(*pulses); i++)
+		smf_track_add_event_pulses(track, smf_event_new_from_bytes(0x90, i, 100), pulses[i]);
+
+	for (i = 0; i < sizeof(windows) / sizeof(*windows); i++) {
+		events = smf_track_get_events_in_range_pulses(track, windows[i][0], windows[i][1], &number_of_events);
+
+		CHECK(number_of_events == windows[i][2], "Window %d - %d pulses: %d events found, expected %d.",
+			windows[i][0], windows[i][1], number_of_events, windows[i][2]);
+
+		if (number_of_events > 0)
+			CHECK(events[0]->time_pulses >= windows[i][0] && events[number_of_events - 1]->time_pulses < windows[i][1],
+				"Window %d - %d pulses: events found are outside of it.", windows[i][0], windows[i][1]);
+	}
+
+	smf_delete(smf);
+}
+
+int
+main(void)
+{
+	static unsigned char tempo_data[] = {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20};
+	int i, j, total = 0, count, number_of_events;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event, **song, **events;
+	struct window_struct window;
+
+	check_boundaries();
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (1);
+
+	srand(25);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (1);
+
+		smf_add_track(smf, track);
+
+		number_of_events = rand() % MAX_EVENTS_PER_TRACK;
+
+		for (j = 0; j < number_of_events; j++) {
+			event = smf_event_new_from_bytes(0x90, i, 100);
+			if (event == NULL)
+				return (1);
+
+			smf_track_add_event_pulses(track, event, rand() % MAX_PULSES);
+		}
+
+		total += number_of_events;
+	}
+
+	/* Tempo changes, so that seconds are not just pulses scaled. */
+	for (i = 0; i < 4; i++) {
+		tempo_data[3] = 0x03 + 3 * i;
+		event = smf_event_new_from_pointer(tempo_data, sizeof(tempo_data));
+		if (event == NULL)
+			return (1);
+
+		smf_track_add_event_pulses(smf_get_track_by_number(smf, 2), event, 1 + i * MAX_PULSES / 4);
+		total++;
+	}
+
+	song = malloc(total * sizeof(smf_event_t *));
+	events = malloc(total * sizeof(smf_event_t *));
+	if (song == NULL || events == NULL)
+		return (1);
+
+	smf_rewind(smf);
+	for (count = 0; (event = smf_get_next_event(smf)) != NULL; count++)
+		song[count] = event;
+
+	CHECK(count == total, "Song has %d events, expected %d.", count, total);
+
+	/* Somewhere in the middle of the song. */
+	CHECK(smf_seek_to_pulses(smf, MAX_PULSES / 2) == 0, "Cannot seek.");
+
+	/* Windows starting and ending at events, between them, empty and covering the whole song. */
+	for (i = 0; i < NUMBER_OF_QUERIES; i++) {
+		window.from_pulses = song[rand() % count]->time_pulses + (i % 3 == 1);
+		window.to_pulses = i % 4 == 0 ? window.from_pulses : song[rand() % count]->time_pulses + (i % 5 == 2);
+		if (i == 0) {
+			window.from_pulses = 0;
+			window.to_pulses = MAX_PULSES + 1;
+		}
+
+		window.from_seconds = window.to_seconds = -1.0;
+		check_window(smf, &window, song, count, events);
+
+		window.from_seconds = song[rand() % count]->time_seconds;
+		window.to_seconds = i % 4 == 0 ? window.from_seconds : song[rand() % count]->time_seconds + (i % 5 == 2) * 0.001;
+		window.from_pulses = window.to_pulses = -1;
+		check_window(smf, &window, song, count, events);
+	}
+
+	smf_delete(smf);
+	free(song);
+	free(events);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,152 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that removing events through pointers held by the caller keeps event numbers,
+ * delta times and smf_event_index() right.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_EVENTS	200000
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/*
+ * Checks that "expected", of which "count" are left, are the events of the track, in order.
+ */
+static void
+check_track(smf_track_t *track, smf_event_t **expected, int count)
+{
+	int i, previous_pulses = 0;
+	smf_event_t *event;
+
+	CHECK(track->number_of_events == count, "%d events in the track, expected %d.", track->number_of_events, count);
+
+	for (i = 0; i < count; i++) {
+		event = smf_track_get_event_by_number(track, i + 1);
+
+		CHECK(event == expected[i], "Event #%d is not the expected one.", i + 1);
+		CHECK(expected[i]->event_number == i + 1, "Event #%d has number %d.", i + 1, expected[i]->event_number);
+		CHECK(smf_event_index(expected[i]) == i, "Event #%d has index %d.", i + 1, smf_event_index(expected[i]));
+		CHECK(expected[i]->delta_time_pulses == expected[i]->time_pulses - previous_pulses,
+			"Event #%d has delta time %d, expected %d.", i + 1, expected[i]->delta_time_pulses,
+			expected[i]->time_pulses - previous_pulses);
+
+		previous_pulses = expected[i]->time_pulses;
+	}
+
+	CHECK(smf_track_get_event_by_number(track, count + 1) == NULL, "Track has more than %d events.", count);
+}
+
+int
+main(void)
+{
+	int i, kept;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t **events;
+
+	smf = smf_new();
+	track = smf_track_new();
+	events = malloc(NUMBER_OF_EVENTS * sizeof(smf_event_t *));
+	if (smf == NULL || track == NULL || events == NULL)
+		return (1);
+
+	smf_add_track(smf, track);
+
+	for (i = 0; i < NUMBER_OF_EVENTS; i++) {
+		events[i] = smf_event_new_from_bytes(0x90, 60, 100);
+		if (events[i] == NULL)
+			return (1);
+
+		smf_track_add_event_pulses(track, events[i], i * 2);
+	}
+
+	/* Remove the first half, from the front.  Events left keep working in between. */
+	for (i = 0; i < NUMBER_OF_EVENTS / 2; i++) {
+		smf_event_remove_from_track(events[i]);
+		smf_event_delete(events[i]);
+
+		CHECK(events[i + 1]->track == track, "Event %d got detached.", i + 1);
+		CHECK(smf_event_index(events[i + 1]) == events[i + 1]->event_number - 1,
+			"Event %d is not where its number says.", i + 1);
+	}
+
+	check_track(track, events + NUMBER_OF_EVENTS / 2, NUMBER_OF_EVENTS / 2);
+
+	/* Remove every other one of the rest, from the back, and then a few from the front again. */
+	for (i = NUMBER_OF_EVENTS - 1; i >= NUMBER_OF_EVENTS / 2; i -= 2) {
+		smf_event_remove_from_track(events[i]);
+		smf_event_delete(events[i]);
+		events[i] = NULL;
+	}
+
+	for (i = NUMBER_OF_EVENTS / 2; i < NUMBER_OF_EVENTS / 2 + 10; i += 2) {
+		smf_event_remove_from_track(events[i]);
+		smf_event_delete(events[i]);
+		events[i] = NULL;
+	}
+
+	for (i = NUMBER_OF_EVENTS / 2, kept = 0; i < NUMBER_OF_EVENTS; i++) {
+		if (events[i] != NULL)
+			events[kept++] = events[i];
+	}
+
+	check_track(track, events, kept);
+
+	/* Removing everything leaves the track empty. */
+	for (i = 0; i < kept; i++) {
+		smf_event_remove_from_track(events[i]);
+		smf_event_delete(events[i]);
+	}
+
+	check_track(track, events, 0);
+
+	smf_delete(smf);
+	free(events);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,256 @@
+/*-
+ * Copyright (c) 2007, 2008 Edward Tomasz Napierała <trasz@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * ALTHOUGH THIS SOFTWARE IS MADE OF WIN AND SCIENCE, IT IS PROVIDED BY THE
+ * AUTHOR AND CONTRIBUTORS ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+ * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file
+ *
+ * Checks that smf_seek_to_pulses(), smf_seek_to_seconds() and smf_seek_to_event(), which find
+ * the position in every track using binary search, leave the song where seeking by walking through
+ * it with smf_peek_next_event() and smf_skip_next_event() would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "smf.h"
+#include "smf_private.h"
+
+#define NUMBER_OF_TRACKS	9
+#define MAX_EVENTS_PER_TRACK	400
+#define MAX_PULSES		2000
+#define NUMBER_OF_SEEKS		200
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL: " __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		failures++; \
+	} \
+} while (0)
+
+/* Where to seek to; only one of the fields is used. */
+struct position_struct {
+	int		pulses;
+	double		seconds;
+	smf_event_t	*event;
+};
+
+/*
+ * Seeks the way smf_seek_to_*() used to: rewinds, then skips events until the next one is at
+ * the position.  Returns nonzero if the position is past the end of the song.
+ */
+static int
+walk_to(smf_t *smf, const struct position_struct *position)
+{
+	smf_event_t *event;
+
+	smf_rewind(smf);
+
+	for (;;) {
+		event = smf_peek_next_event(smf);
+		if (event == NULL)
+			return (-1);
+
+		if (position->event != NULL && event == position->event)
+			return (0);
+
+		if (position->event == NULL && position->pulses >= 0 && event->time_pulses >= position->pulses)
+			return (0);
+
+		if (position->event == NULL && position->pulses < 0 && event->time_seconds >= position->seconds)
+			return (0);
+
+		smf_skip_next_event(smf);
+	}
+}
+
+static int
+seek_to(smf_t *smf, const struct position_struct *position)
+{
+	smf_rewind(smf);
+
+	if (position->event != NULL)
+		return (smf_seek_to_event(smf, position->event));
+
+	if (position->pulses >= 0)
+		return (smf_seek_to_pulses(smf, position->pulses));
+
+	return (smf_seek_to_seconds(smf, position->seconds));
+}
+
+/*
+ * Puts the events left to play into "events", which needs room for all of them, and returns their number.
+ */
+static int
+drain(smf_t *smf, smf_event_t **events)
+{
+	int count = 0;
+	smf_event_t *event;
+
+	while ((event = smf_get_next_event(smf)) != NULL)
+		events[count++] = event;
+
+	return (count);
+}
+
+/*
+ * Checks that seeking to the position leaves the same events to play as walking to it.
+ */
+static void
+check_seek(smf_t *smf, const struct position_struct *position, smf_event_t **sought, smf_event_t **walked)
+{
+	int i, sought_error, walked_error, number_sought, number_walked;
+
+	sought_error = seek_to(smf, position);
+	number_sought = sought_error ? 0 : drain(smf, sought);
+
+	walked_error = walk_to(smf, position);
+	number_walked = walked_error ? 0 : drain(smf, walked);
+
+	CHECK(!sought_error == !walked_error, "Seeking to %d pulses, %f seconds, event %p returned %d, walking %d.",
+		position->pulses, position->seconds, (void *)position->event, sought_error, walked_error);
+	CHECK(number_sought == number_walked, "Seeking to %d pulses, %f seconds, event %p left %d events, walking %d.",
+		position->pulses, position->seconds, (void *)position->event, number_sought, number_walked);
+
+	for (i = 0; i < number_sought && i < number_walked; i++) {
+		if (sought[i] != walked[i]) {
+			CHECK(0, "Seeking to %d pulses, %f seconds, event %p: event #%d left differs.",
+				position->pulses, position->seconds, (void *)position->event, i + 1);
+			break;
+		}
+	}
+}
+
+static void
+quiet_log_handler(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer user_data)
+{
+}
+
+int
+main(void)
+{
+	static unsigned char tempo_data[] = {0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20};
+	int i, j, total = 0, number_of_events;
+	smf_t *smf;
+	smf_track_t *track;
+	smf_event_t *event, **sought, **walked;
+	struct position_struct position;
+
+	/* Seeking past the end complains. */
+	g_log_set_default_handler(quiet_log_handler, NULL);
+
+	smf = smf_new();
+	if (smf == NULL)
+		return (1);
+
+	srand(18);
+
+	for (i = 0; i < NUMBER_OF_TRACKS; i++) {
+		track = smf_track_new();
+		if (track == NULL)
+			return (1);
+
+		smf_add_track(smf, track);
+
+		number_of_events = rand() % MAX_EVENTS_PER_TRACK;
+
+		for (j = 0; j < number_of_events; j++) {
+			event = smf_event_new_from_bytes(0x90, i, 100);
+			if (event == NULL)
+				return (1);
+
+			smf_track_add_event_pulses(track, event, rand() % MAX_PULSES);
+		}
+
+		total += number_of_events;
+	}
+
+	/* Tempo changes, so that seconds are not just pulses scaled. */
+	for (i = 0; i < 5; i++) {
+		tempo_data[3] = 0x03 + 2 * i;
+		event = smf_event_new_from_pointer(tempo_data, sizeof(tempo_data));
+		if (event == NULL)
+			return (1);
+
+		smf_track_add_event_pulses(smf_get_track_by_number(smf, 1), event, i * MAX_PULSES / 5);
+		total++;
+	}
+
+	sought = malloc(total * sizeof(smf_event_t *));
+	walked = malloc(total * sizeof(smf_event_t *));
+	if (sought == NULL || walked == NULL)
+		return (1);
+
+	/* Start, end, past the end, and lots of random places, many of them right at the events. */
+	for (i = 0; i < NUMBER_OF_SEEKS; i++) {
+		position.event = NULL;
+		position.seconds = -1.0;
+
+		if (i < 3)
+			position.pulses = i == 0 ? 0 : smf_get_length_pulses(smf) + i - 1;
+		else
+			position.pulses = rand() % (MAX_PULSES + 10);
+
+		check_seek(smf, &position, sought, walked);
+
+		position.pulses = -1;
+		track = smf_get_track_by_number(smf, 1 + rand() % NUMBER_OF_TRACKS);
+		event = NULL;
+		if (track->number_of_events > 0)
+			event = smf_track_get_event_by_number(track, 1 + rand() % track->number_of_events);
+
+		if (i < 3)
+			position.seconds = i == 0 ? 0.0 : smf_get_length_seconds(smf) + i - 1;
+		else if (i % 2 || event == NULL)
+			position.seconds = smf_get_length_seconds(smf) * (rand() % 1000) / 1000.0;
+		else
+			position.seconds = event->time_seconds;
+
+		check_seek(smf, &position, sought, walked);
+
+		/* Events happening at the same time as others, in tracks before and after them. */
+		if (event == NULL)
+			continue;
+
+		position.seconds = -1.0;
+		position.event = event;
+
+		check_seek(smf, &position, sought, walked);
+	}
+
+	smf_delete(smf);
+	free(sought);
+	free(walked);
+
+	if (failures) {
+		fprintf(stderr, "%d check(s) failed.\n", failures);
+		return (1);
+	}
+
+	return (0);
+}